@@ -0,0 +1,311 @@
+#include "fault.hpp"
+#include "netlist.hpp"
+#include "parser.hpp"
+#include "random.hpp"
+#include "simd.hpp"
+#include "visualization.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <string.h>
+#include <vector>
+
+/**
+ * Benchmark harness. Every phase runs `repeat` times on the same circuit and one JSON
+ * object per phase is printed on its own line, so results can be appended to a file
+ * and compared between commits, engines and widths. Progress messages of the library
+ * are discarded while the harness runs.
+ */
+
+struct BenchmarkOptions {
+  std::string input_file_name = "synthetic.bench";
+  std::size_t repeat = 3;
+  u_int32_t rounds = 1000;
+  std::size_t key_bits = 32;
+  std::size_t patterns = 64;
+  std::size_t threads = 0;
+  std::size_t batch_size = 1;
+  u_int64_t seed = 1;
+  int simd_width = 0;
+  // engines of the fault impact analysis, `FLL::AnalysisOptions::Engine` values
+  std::vector<int> engines = { 2, 3 };
+  std::vector<std::string> phases = { "load", "compile", "sim", "parallel_sim", "fia_run", "rll_lock", "fll_lock", "save", "verilog", "verilog_gates" };
+};
+
+static void print_help() {
+  std::cout << "Benchmark harness" << std::endl;
+  std::cout << "Usage: " << std::endl;
+  std::cout << "  -i, --input-file <filename>             circuit, .bench or snapshot. (default: synthetic.bench)" << std::endl;
+  std::cout << "  -n, --repeat <N>                        runs of every phase. (default: 3)" << std::endl;
+  std::cout << "  -r, --rounds <N>                        patterns of the fault impact analysis. (default: 1000)" << std::endl;
+  std::cout << "  -b, --lock-by-bits <N>                  key bits of the locking phases. (default: 32)" << std::endl;
+  std::cout << "  -k, --batch-size <N>                    key gates per ranking in the fll_lock phase. (default: 1)" << std::endl;
+  std::cout << "  -P, --patterns <N>                      patterns of the sim phase, one Sim::run each, random and walking-bit. (default: 64)" << std::endl;
+  std::cout << "  -t, --threads <N>                       worker threads, 0 uses every hardware thread. (default: 0)" << std::endl;
+  std::cout << "  -s, --seed <N>                          seed of patterns and keys. (default: 1)" << std::endl;
+  std::cout << "  -e, --engines <scalar,pattern,fault>    engines of the fia_run and fll_lock phases. (default: pattern,fault)" << std::endl;
+  std::cout << "  -p, --phases <name,...>                 phases to run. (default: all)" << std::endl;
+  std::cout << "                                          load compile sim parallel_sim fia_run rll_lock fll_lock save verilog verilog_gates" << std::endl;
+  std::cout << "      --simd <auto | 64 | 256 | 512>      patterns per gate evaluation. (default: auto)" << std::endl;
+  std::cout << "  -h, --help                              print help message" << std::endl;
+}
+
+static std::vector<std::string> split(const std::string& text) {
+  std::vector<std::string> parts;
+  std::size_t begin = 0;
+  while (begin <= text.size()) {
+    std::size_t end = text.find(',', begin);
+    if (end == std::string::npos) end = text.size();
+    if (end > begin) parts.push_back(text.substr(begin, end - begin));
+    begin = end + 1;
+  }
+  return parts;
+}
+
+static BenchmarkOptions parse_arguments(int argc, char* argv[]) {
+#define option_cmp(argv, option) strncmp(argv, option, sizeof(option)) == 0
+  BenchmarkOptions options;
+  for (int i = 1; i < argc; i++) {
+    if (option_cmp(argv[i], "-h") || option_cmp(argv[i], "--help")) {
+      print_help();
+      exit(0);
+    }
+    if (i + 1 >= argc) {
+      std::cerr << "Missing argument: " << argv[i] << std::endl;
+      exit(1);
+    }
+    const char* option = argv[i];
+    const char* value = argv[++i];
+    if (option_cmp(option, "-i") || option_cmp(option, "--input-file")) options.input_file_name = value;
+    else if (option_cmp(option, "-n") || option_cmp(option, "--repeat")) options.repeat = std::max(1ul, strtoul(value, 0, 10));
+    else if (option_cmp(option, "-r") || option_cmp(option, "--rounds")) options.rounds = std::max(1ul, strtoul(value, 0, 10));
+    else if (option_cmp(option, "-b") || option_cmp(option, "--lock-by-bits")) options.key_bits = strtoul(value, 0, 10);
+    else if (option_cmp(option, "-k") || option_cmp(option, "--batch-size")) options.batch_size = std::max(1ul, strtoul(value, 0, 10));
+    else if (option_cmp(option, "-P") || option_cmp(option, "--patterns")) options.patterns = strtoul(value, 0, 10);
+    else if (option_cmp(option, "-t") || option_cmp(option, "--threads")) options.threads = strtoul(value, 0, 10);
+    else if (option_cmp(option, "-s") || option_cmp(option, "--seed")) options.seed = strtoull(value, 0, 10);
+    else if (option_cmp(option, "--simd")) options.simd_width = option_cmp(value, "auto") ? 0 : strtol(value, 0, 10);
+    else if (option_cmp(option, "-p") || option_cmp(option, "--phases")) options.phases = split(value);
+    else if (option_cmp(option, "-e") || option_cmp(option, "--engines")) {
+      options.engines.clear();
+      for (const auto& engine: split(value)) {
+        if (engine == "scalar") options.engines.push_back(FLL::AnalysisOptions::Engine::SCALAR);
+        else if (engine == "pattern") options.engines.push_back(FLL::AnalysisOptions::Engine::PATTERN_PARALLEL);
+        else if (engine == "fault") options.engines.push_back(FLL::AnalysisOptions::Engine::FAULT_PARALLEL);
+        else {
+          std::cerr << "Invalid engine: " << engine << std::endl;
+          exit(1);
+        }
+      }
+    }
+    else {
+      std::cerr << "Unknown input: " << option << std::endl;
+      print_help();
+      exit(1);
+    }
+  }
+#undef option_cmp
+  return options;
+}
+
+static const char* engine_name(int engine) {
+  switch (engine) {
+    case FLL::AnalysisOptions::Engine::SCALAR: return "scalar";
+    case FLL::AnalysisOptions::Engine::PATTERN_PARALLEL: return "pattern";
+    case FLL::AnalysisOptions::Engine::FAULT_PARALLEL: return "fault";
+    default: return "auto";
+  }
+}
+
+static void load(core::NodeMap& map, const std::string& file_name) {
+  if (core::NodeMap::is_snapshot(file_name))
+    map.load_snapshot(file_name);
+  else
+    map.load(file_name);
+}
+
+class Benchmark {
+  const BenchmarkOptions& _options;
+  std::ostream& _out;
+  std::string _circuit;
+  std::size_t _nodes = 0;
+  std::size_t _gates = 0;
+
+  public:
+  Benchmark(const BenchmarkOptions& options, std::ostream& out) : _options(options), _out(out) { }
+  void set_circuit(const std::string& name, const core::NodeMap& map) {
+    _circuit = name;
+    _nodes = map.size();
+    _gates = map.gates.size();
+  }
+  /**
+   * @brief Time `run` `repeat` times, `prepare` runs untimed before every call
+   *
+   * @param engine engine name, empty if the phase has none
+   */
+  void measure(const std::string& phase, const std::string& engine, const std::function<void()>& prepare, const std::function<void()>& run) {
+    std::vector<double> seconds;
+    for (std::size_t i = 0; i < _options.repeat; ++i) {
+      prepare();
+      const auto start = std::chrono::steady_clock::now();
+      run();
+      seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::sort(seconds.begin(), seconds.end());
+    double total = 0;
+    for (const auto& s: seconds) total += s;
+    char line[1024];
+    snprintf(line, sizeof(line),
+             "{\"circuit\": \"%s\", \"nodes\": %zu, \"gates\": %zu, \"phase\": \"%s\", \"engine\": \"%s\", \"simd\": %zu, \"threads\": %zu, "
+             "\"rounds\": %u, \"key_bits\": %zu, \"repeat\": %zu, \"min_s\": %.6f, \"median_s\": %.6f, \"mean_s\": %.6f}",
+             _circuit.c_str(), _nodes, _gates, phase.c_str(), engine.c_str(), simd::kernels().words * 64, _options.threads,
+             _options.rounds, _options.key_bits, _options.repeat, seconds.front(), seconds[seconds.size() / 2], total / seconds.size());
+    _out << line << std::endl;
+  }
+};
+
+int main(int argc, char* argv[]) {
+  const BenchmarkOptions options = parse_arguments(argc, argv);
+  try {
+    simd::select((simd::Width)options.simd_width);
+  } catch (std::runtime_error& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  auto wants = [&options](const std::string& phase) {
+    return std::find(options.phases.begin(), options.phases.end(), phase) != options.phases.end();
+  };
+
+  // results go to the real stdout, everything the library prints is dropped
+  std::ostream out(std::cout.rdbuf());
+  std::ofstream null("/dev/null");
+  std::cout.rdbuf(null.rdbuf());
+
+  const std::string circuit = std::filesystem::path(options.input_file_name).filename().string();
+  const std::filesystem::path scratch = std::filesystem::temp_directory_path();
+  const std::string output_file_name = (scratch / "benchmark_output.bench").string();
+  const std::string visualization_file_name = (scratch / "benchmark_output.v").string();
+
+  try {
+    core::NodeMap map;
+    load(map, options.input_file_name);
+    Benchmark benchmark(options, out);
+    benchmark.set_circuit(circuit, map);
+    const core::FlatNetlist netlist(map);
+    auto nothing = []() { };
+    std::unique_ptr<core::NodeMap> fresh;
+    auto reload = [&]() {
+      fresh.reset(new core::NodeMap());
+      load(*fresh, options.input_file_name);
+    };
+
+    if (wants("load")) {
+      benchmark.measure("load", "", [&]() { fresh.reset(new core::NodeMap()); }, [&]() { load(*fresh, options.input_file_name); });
+    }
+    if (wants("compile")) {
+      benchmark.measure("compile", "", nothing, [&]() { core::FlatNetlist compiled(map); });
+    }
+    if (wants("sim")) {
+      std::mt19937_64 random(options.seed);
+      std::vector<FLL::SimulationValues> patterns(options.patterns, FLL::SimulationValues(netlist.inputs.size()));
+      for (auto& pattern: patterns) {
+        for (auto& value: pattern) value = random() & 1 ? FLL::FLL_TRUE : FLL::FLL_FALSE;
+      }
+      benchmark.measure("sim", "scalar", nothing, [&]() {
+        FLL::Sim sim(netlist);
+        for (const auto& pattern: patterns) {
+          sim.set_input(pattern);
+          sim.run();
+        }
+      });
+      benchmark.measure("sim", "event", nothing, [&]() {
+        FLL::Sim sim(netlist, true);
+        for (const auto& pattern: patterns) {
+          sim.set_input(pattern);
+          sim.run();
+        }
+      });
+      // a walking-bit sweep, every pattern flips one input of the one before
+      std::vector<FLL::SimulationValues> walk(patterns.size(), patterns.front());
+      for (std::size_t i = 1; i < walk.size() && !netlist.inputs.empty(); ++i) {
+        walk[i] = walk[i - 1];
+        FLL::FLL_Node_Value& value = walk[i][i % netlist.inputs.size()];
+        value = value == FLL::FLL_TRUE ? FLL::FLL_FALSE : FLL::FLL_TRUE;
+      }
+      benchmark.measure("sim", "scalar_walk", nothing, [&]() {
+        FLL::Sim sim(netlist);
+        for (const auto& pattern: walk) {
+          sim.set_input(pattern);
+          sim.run();
+        }
+      });
+      benchmark.measure("sim", "event_walk", nothing, [&]() {
+        FLL::Sim sim(netlist, true);
+        for (const auto& pattern: walk) {
+          sim.set_input(pattern);
+          sim.run();
+        }
+      });
+    }
+    if (wants("parallel_sim")) {
+      FLL::ParallelSim sim(netlist);
+      std::mt19937_64 random(options.seed);
+      std::vector<u_int64_t> block(netlist.inputs.size() * sim.words());
+      for (auto& word: block) word = random();
+      const std::size_t blocks = (options.rounds + sim.lanes() - 1) / sim.lanes();
+      benchmark.measure("parallel_sim", "", nothing, [&]() {
+        for (std::size_t i = 0; i < blocks; ++i) {
+          sim.set_input(block);
+          sim.run();
+        }
+      });
+    }
+    for (const auto& engine: options.engines) {
+      FLL::AnalysisOptions analysis;
+      analysis.engine = (FLL::AnalysisOptions::Engine)engine;
+      analysis.threads = options.threads;
+      analysis.batch_size = options.batch_size;
+      if (wants("fia_run")) {
+        benchmark.measure("fia_run", engine_name(engine), nothing, [&]() {
+          FLL::FaultImpactAnalysis fia(map, analysis);
+          fia.run(options.rounds, options.seed);
+        });
+      }
+      if (wants("fll_lock")) {
+        benchmark.measure("fll_lock", engine_name(engine), reload, [&]() {
+          FLL::lock_n_gates(*fresh, options.key_bits, options.rounds, options.seed, analysis);
+        });
+      }
+    }
+    if (wants("rll_lock")) {
+      benchmark.measure("rll_lock", "", reload, [&]() { RLL::lock_n_gates(*fresh, options.key_bits, options.seed); });
+    }
+    if (wants("save")) {
+      benchmark.measure("save", "", nothing, [&]() { map.save(output_file_name, false, options.threads); });
+    }
+    if (wants("verilog")) {
+      benchmark.measure("verilog", "", nothing, [&]() {
+        Visualization::write_to_verilog_file(map, visualization_file_name, false, options.threads);
+      });
+    }
+    if (wants("verilog_gates")) {
+      benchmark.measure("verilog_gates", "", nothing, [&]() {
+        Visualization::write_to_verilog_file(map, visualization_file_name, true, options.threads);
+      });
+    }
+  } catch (std::exception& e) {
+    std::cout.rdbuf(out.rdbuf());
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  std::cout.rdbuf(out.rdbuf());
+  std::filesystem::remove(output_file_name);
+  std::filesystem::remove(visualization_file_name);
+  return 0;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+namespace core {
+
+/**
+ * @brief Queue between two pipeline stages. `push` blocks while `capacity` items are
+ * waiting, so a fast producer cannot run ahead of its consumer by more than that.
+ */
+template <typename T>
+class BoundedQueue {
+  std::deque<T> _items;
+  std::size_t _capacity;
+  bool _closed = false;
+  std::mutex _mutex;
+  std::condition_variable _not_full;
+  std::condition_variable _not_empty;
+
+  public:
+  explicit BoundedQueue(std::size_t capacity) : _capacity(capacity == 0 ? 1 : capacity) { }
+  BoundedQueue(const BoundedQueue&) = delete;
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+  /**
+   * @brief Add an item, waiting for room if the queue is full
+   */
+  void push(T item) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _not_full.wait(lock, [this] { return _items.size() < _capacity; });
+    _items.push_back(std::move(item));
+    _not_empty.notify_one();
+  }
+  /**
+   * @brief Take the oldest item, waiting for one if the queue is empty
+   *
+   * @return `false` if the queue is closed and empty
+   */
+  bool pop(T& item) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _not_empty.wait(lock, [this] { return _closed || !_items.empty(); });
+    if (_items.empty()) return false;
+    item = std::move(_items.front());
+    _items.pop_front();
+    _not_full.notify_one();
+    return true;
+  }
+  /**
+   * @brief Tell the consumer that no more items will come
+   */
+  void close() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _closed = true;
+    _not_empty.notify_all();
+  }
+};
+
+}
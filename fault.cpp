@@ -1,5 +1,7 @@
 #include "fault.hpp"
-#include <stack>
+#include "metrics.hpp"
+#include "rng.hpp"
+#include "thread_pool.hpp"
 #include <algorithm>
 #include <numeric>
 #include <cmath>
@@ -8,202 +10,1061 @@ using core::GateType;
 
 namespace FLL {
 
-void Sim::run_node(core::Node* node) {
-  // std::cout << "Running node " << node->name << std::endl;
-  if (node->inputs.size() == 0) return;
-  if (node == this->_fault_node) return;
-  if (std::any_of(node->inputs.begin(), node->inputs.end(), [node, this](core::Node* n) { return this->_values[n] == FLL_UNKNOWN; })) {
-    this->_values[node] = FLL_UNKNOWN;
+/**
+ * @brief Scalar gate kernels for `simd::dispatch`. A gate is unknown if any of its inputs is,
+ * an unknown value is -1 so the OR of all inputs is negative exactly then.
+ */
+struct ScalarGate {
+  template <GateType Type, std::size_t Arity>
+  static inline void run(const u_int32_t* fanins, std::size_t n, FLL_Node_Value* values, u_int32_t out) {
+    constexpr simd::GateOp op = simd::GateTraits<Type>::op;
+    const std::size_t count = op == simd::GateOp::COPY ? 1 : Arity == 0 ? n : Arity;
+    int acc = values[fanins[0]];
+    int unknown = acc;
+    for (std::size_t i = 1; i < count; ++i) {
+      const int next = values[fanins[i]];
+      unknown |= next;
+      if constexpr (op == simd::GateOp::AND) acc &= next;
+      else if constexpr (op == simd::GateOp::OR) acc |= next;
+      else acc ^= next;
+    }
+    if constexpr (simd::GateTraits<Type>::invert) acc ^= 1;
+    values[out] = unknown < 0 ? FLL_UNKNOWN : (FLL_Node_Value)(acc & 1);
+  }
+};
+
+struct ScalarBucket {
+  template <GateType Type, std::size_t Arity>
+  static void run(const u_int32_t* fanins, const u_int32_t* outs, std::size_t count, std::size_t n, FLL_Node_Value* values) {
+    for (std::size_t k = 0; k < count; ++k) ScalarGate::run<Type, Arity>(fanins + k * n, n, values, outs[k]);
+  }
+};
+
+void Sim::run_node(u_int32_t index) {
+  const u_int32_t n = this->_netlist.fanin_count(index);
+  if (n == 0) return;
+  if (index == this->_fault_index) return;
+  ++this->_evaluations;
+  simd::dispatch<ScalarGate>(this->_netlist.types[index], n, this->_netlist.fanin_begin(index), n, this->_values.data(), index);
+}
+
+void Sim::run_buckets() {
+  const core::FlatNetlist& netlist = this->_netlist;
+  for (const auto& bucket: netlist.buckets) {
+    simd::dispatch<ScalarBucket>(bucket.type, bucket.arity, &netlist.bucket_fanins[bucket.fanins], &netlist.bucket_gates[bucket.begin],
+                                 bucket.end - bucket.begin, bucket.arity, this->_values.data());
+  }
+  this->_evaluations += netlist.bucket_gates.size();
+}
+
+void Sim::run() {
+  ++this->_version;
+  if (this->_queue && this->_settled) {
+    // levels only grow along an edge, so a gate is evaluated after all of its changed fanins
+    u_int32_t gate;
+    while (this->_queue->pop(gate)) {
+      const FLL_Node_Value old = this->_values[gate];
+      this->run_node(gate);
+      if (this->_values[gate] == old) continue;
+      if (this->_loaded_from) this->_changed.push_back(gate);
+      this->_queue->push_fanouts(gate);
+    }
     return;
   }
-  switch (node->type) {
-    case GateType::NOT:
-      this->_values[node] = this->_values[node->inputs[0]] == FLL_TRUE ? FLL_FALSE : FLL_TRUE;
-      break;
+  // do sanity check before starting simulation
+  if (std::any_of(this->_netlist.inputs.begin(), this->_netlist.inputs.end(), [this](u_int32_t n) { return this->_values[n] == FLL_UNKNOWN; })) {
+    throw std::runtime_error("Circuit has unknown inputs");
+  }
+
+  // a fault must not be overwritten by its own gate, that sweep goes node by node
+  if (this->_fault_index != this->_netlist.size()) {
+    // nodes are numbered in topological order, every input is ready before its consumers
+    for (u_int32_t i = 0; i < this->_netlist.size(); ++i) {
+      this->run_node(i);
+    }
+  }
+  else {
+    this->run_buckets();
+  }
+  this->_settled = true;
+}
+
+void Sim::load(const Sim& reference) {
+  if (this->_queue) {
+    u_int32_t pending;
+    while (this->_queue->pop(pending)) { }
+  }
+  const u_int32_t n = this->_netlist.size();
+  if (this->_queue && this->_settled && this->_loaded_from == &reference && this->_loaded_version == reference._version) {
+    for (const auto& index: this->_changed) this->_values[index] = reference._values[index];
+    if (this->_fault_index != n) this->_values[this->_fault_index] = reference._values[this->_fault_index];
+  }
+  else {
+    this->_values = reference._values;
+  }
+  this->_changed.clear();
+  this->_fault_node = nullptr;
+  this->_fault_index = n;
+  this->_settled = reference._settled;
+  this->_loaded_from = &reference;
+  this->_loaded_version = reference._version;
+}
+
+ParallelSim::ParallelSim(const core::FlatNetlist& netlist)
+  : _netlist(netlist), _kernels(simd::kernels()), _values(netlist.size() * _kernels.words, 0), _fault_index(netlist.size()),
+    _faulty(_values.size(), 0), _queue(netlist), _pattern(lanes()), _inject(netlist.size(), netlist.size()) { }
+
+void ParallelSim::set_input(const std::vector<u_int64_t>& words) {
+  const std::size_t n = this->_kernels.words;
+  if (words.size() != this->_netlist.inputs.size() * n) {
+    throw std::invalid_argument("Input size mismatch");
+  }
+  for (std::size_t i = 0; i < this->_netlist.inputs.size(); ++i) {
+    std::copy(words.begin() + i * n, words.begin() + (i + 1) * n, this->_values.begin() + this->_netlist.inputs[i] * n);
+  }
+}
+
+void ParallelSim::set_fault(core::Node* fault_node, FLL_Node_Value value) {
+  const std::size_t n = this->_kernels.words;
+  this->_fault_index = this->_netlist.index_of(fault_node);
+  std::fill(this->_values.begin() + this->_fault_index * n, this->_values.begin() + (this->_fault_index + 1) * n, value == FLL_TRUE ? ~0ULL : 0ULL);
+}
+
+void ParallelSim::run() {
+  const core::FlatNetlist& netlist = this->_netlist;
+  if (this->_fault_index != netlist.size()) {
+    for (u_int32_t i = 0; i < netlist.size(); ++i) {
+      const u_int32_t n = netlist.fanin_count(i);
+      if (n == 0) continue;
+      if (i == this->_fault_index) continue;
+      this->_kernels.eval(netlist.types[i], netlist.fanin_begin(i), n, this->_values.data(), i);
+      ++this->_evaluations;
+    }
+  }
+  else {
+    // every bucket is one type and arity, its gates run through one specialized loop
+    for (const auto& bucket: netlist.buckets) {
+      this->_kernels.eval_bucket(bucket.type, bucket.arity, &netlist.bucket_fanins[bucket.fanins], &netlist.bucket_gates[bucket.begin],
+                                 bucket.end - bucket.begin, this->_values.data());
+    }
+    this->_evaluations += netlist.bucket_gates.size();
+  }
+  this->_faulty = this->_values;
+  this->_changed.clear();
+  this->_pattern = this->lanes();
+}
+
+void ParallelSim::set_values(const u_int64_t* values) {
+  std::copy(values, values + this->_values.size(), this->_values.begin());
+  this->_faulty = this->_values;
+  this->_changed.clear();
+  this->_pattern = this->lanes();
+}
+
+void ParallelSim::reference(u_int32_t index, u_int64_t* out) const {
+  const std::size_t n = this->_kernels.words;
+  if (this->_pattern == this->lanes()) {
+    std::copy(this->_values.begin() + index * n, this->_values.begin() + (index + 1) * n, out);
+    return;
+  }
+  const u_int64_t bit = (this->_values[index * n + this->_pattern / 64] >> (this->_pattern % 64)) & 1;
+  std::fill(out, out + n, 0 - bit);
+}
+
+bool ParallelSim::matches_reference(u_int32_t index) const {
+  const std::size_t n = this->_kernels.words;
+  const u_int64_t* faulty = &this->_faulty[index * n];
+  if (this->_pattern == this->lanes()) {
+    return std::equal(faulty, faulty + n, &this->_values[index * n]);
+  }
+  const u_int64_t bit = (this->_values[index * n + this->_pattern / 64] >> (this->_pattern % 64)) & 1;
+  return std::all_of(faulty, faulty + n, [bit](u_int64_t word) { return word == 0 - bit; });
+}
+
+void ParallelSim::restore() {
+  const std::size_t n = this->_kernels.words;
+  for (const auto& changed: this->_changed) {
+    this->reference(changed, &this->_faulty[changed * n]);
+  }
+  this->_changed.clear();
+}
+
+const std::vector<u_int32_t>& ParallelSim::run_fault(u_int32_t index, FLL_Node_Value value) {
+  const std::size_t n = this->_kernels.words;
+  this->restore();
+
+  u_int64_t* site = &this->_faulty[index * n];
+  std::fill(site, site + n, value == FLL_TRUE ? ~0ULL : 0ULL);
+  if (this->matches_reference(index)) return this->_changed;
+  this->_changed.push_back(index);
+  this->_queue.push_fanouts(index);
+  u_int32_t gate;
+  while (this->_queue.pop(gate)) {
+    this->_kernels.eval(this->_netlist.types[gate], this->_netlist.fanin_begin(gate), this->_netlist.fanin_count(gate), this->_faulty.data(), gate);
+    ++this->_evaluations;
+    if (this->matches_reference(gate)) continue;
+    this->_changed.push_back(gate);
+    this->_queue.push_fanouts(gate);
+  }
+  return this->_changed;
+}
+
+void ParallelSim::load_pattern(std::size_t pattern) {
+  const std::size_t n = this->_kernels.words;
+  this->_pattern = pattern;
+  for (u_int32_t i = 0; i < this->_netlist.size(); ++i) {
+    this->reference(i, &this->_faulty[i * n]);
+  }
+  this->_changed.clear();
+}
+
+const std::vector<u_int32_t>& ParallelSim::run_faults(const StuckAtFault* faults, std::size_t count) {
+  const std::size_t n = this->_kernels.words;
+  if (count > this->lanes()) {
+    throw std::invalid_argument("More faults than lanes");
+  }
+  this->restore();
+
+  // build the injection masks, several lanes may share a fault site
+  for (const auto& injected: this->_injected) this->_inject[injected] = this->_netlist.size();
+  this->_injected.clear();
+  this->_inject_masks.clear();
+  for (std::size_t k = 0; k < count; ++k) {
+    const u_int32_t index = faults[k].index;
+    if (this->_inject[index] == this->_netlist.size()) {
+      this->_inject[index] = (u_int32_t)this->_injected.size();
+      this->_injected.push_back(index);
+      this->_inject_masks.insert(this->_inject_masks.end(), n, ~0ULL);
+      this->_inject_masks.insert(this->_inject_masks.end(), n, 0ULL);
+    }
+    u_int64_t* masks = &this->_inject_masks[this->_inject[index] * 2 * n];
+    masks[k / 64] &= ~(1ULL << (k % 64));
+    if (faults[k].value == FLL_TRUE) masks[n + k / 64] |= 1ULL << (k % 64);
+  }
+
+  // fault sites are queued themselves, so a site inside another site's cone is evaluated once
+  for (const auto& injected: this->_injected) this->_queue.push(injected);
+  u_int32_t gate;
+  while (this->_queue.pop(gate)) {
+    u_int64_t* value = &this->_faulty[gate * n];
+    const u_int32_t fanin_count = this->_netlist.fanin_count(gate);
+    if (fanin_count != 0) {
+      this->_kernels.eval(this->_netlist.types[gate], this->_netlist.fanin_begin(gate), fanin_count, this->_faulty.data(), gate);
+      ++this->_evaluations;
+    }
+    if (this->_inject[gate] != this->_netlist.size()) {
+      const u_int64_t* masks = &this->_inject_masks[this->_inject[gate] * 2 * n];
+      for (std::size_t w = 0; w < n; ++w) value[w] = (value[w] & masks[w]) | masks[n + w];
+    }
+    if (this->matches_reference(gate)) continue;
+    this->_changed.push_back(gate);
+    this->_queue.push_fanouts(gate);
+  }
+  return this->_changed;
+}
+
+FaultImpactAnalysis::FaultImpactAnalysis(const core::NodeMap& node_map, const AnalysisOptions& options)
+  : _node_map(node_map), _options(options), _pool(new core::ThreadPool(options.threads)) {
+  for (core::NodeId id = 0; id < node_map.size(); ++id) {
+    _fault_impact[node_map.node(id)] = std::make_tuple(0, 0, 0, 0);
+  }
+}
+
+FaultImpactAnalysis::~FaultImpactAnalysis() { }
+
+std::size_t FaultImpactAnalysis::batches() const {
+  const std::size_t lanes = simd::kernels().words * 64;
+  return (this->_rounds + lanes - 1) / lanes;
+}
+
+/**
+ * @brief Word `k` of input `bit` when the inputs count in Gray code, bit `bit` of `p ^ (p >> 1)` for the
+ * patterns `p = 64 * k + lane`. Bit `j` of `p` is a fixed lane mask for `j < 6` and bit `j - 6` of `k` above.
+ */
+static u_int64_t gray_code_word(u_int32_t bit, u_int64_t k) {
+  static const u_int64_t lanes[6] = {
+    0xAAAAAAAAAAAAAAAAULL, 0xCCCCCCCCCCCCCCCCULL, 0xF0F0F0F0F0F0F0F0ULL,
+    0xFF00FF00FF00FF00ULL, 0xFFFF0000FFFF0000ULL, 0xFFFFFFFF00000000ULL,
+  };
+  auto counter = [k](u_int32_t j) { return j < 6 ? lanes[j] : 0 - ((k >> (j - 6)) & 1); };
+  return counter(bit) ^ counter(bit + 1);
+}
+
+bool FaultImpactAnalysis::keeps_batches() const {
+  // 2^n enumerated patterns would not fit, while each of their batches is cheap to build again
+  return this->_gray_bit.empty();
+}
+
+void FaultImpactAnalysis::fill_patterns(std::size_t batch, u_int64_t* out) const {
+  // every input draws from its own stream, so adding key inputs leaves the other patterns alone,
+  // and word `k` of a stream does not depend on the others, so every batch is drawn on its own
+  const std::size_t words = simd::kernels().words;
+  const std::size_t n_inputs = this->_node_map.inputs.size();
+  const std::size_t n_words = (this->_rounds + 63) / 64;
+  std::fill(out, out + n_inputs * words, 0);
+  for (std::size_t j = 0; j < n_inputs; ++j) {
+    const core::Philox stream(this->_seed, core::Philox::stream(core::Philox::PATTERN, (u_int32_t)j));
+    const auto gray = this->_gray_bit.find(this->_node_map.inputs[j]);
+    for (std::size_t k = batch * words; k < std::min(n_words, (batch + 1) * words); ++k) {
+      const std::size_t bits = std::min<std::size_t>(64, this->_rounds - k * 64);
+      const u_int64_t word = gray == this->_gray_bit.end() ? stream.at(k) : gray_code_word(gray->second, k);
+      out[j * words + k % words] = word & (bits == 64 ? ~0ULL : (1ULL << bits) - 1);
+    }
+  }
+}
+
+const u_int64_t* FaultImpactAnalysis::batch_patterns(std::size_t batch, std::vector<u_int64_t>& scratch) const {
+  const std::size_t block = this->_node_map.inputs.size() * simd::kernels().words;
+  if (!this->_patterns.empty()) return &this->_patterns[batch * block];
+  scratch.resize(block);
+  this->fill_patterns(batch, scratch.data());
+  return scratch.data();
+}
+
+void FaultImpactAnalysis::draw_patterns() {
+  const std::size_t block = this->_node_map.inputs.size() * simd::kernels().words;
+  this->_patterns.clear();
+  if (!this->keeps_batches()) return;
+  this->_patterns.assign(this->batches() * block, 0);
+  this->_pool->run(this->batches(), [&](std::size_t batch, std::size_t) {
+    this->fill_patterns(batch, &this->_patterns[batch * block]);
+  });
+}
+
+void FaultImpactAnalysis::select_patterns(u_int32_t rounds) {
+  this->_gray_bit.clear();
+  this->_rounds = rounds;
+  std::vector<const core::Node*> enumerated;
+  for (const auto& name: this->_options.exhaustive_inputs) {
+    const core::Node* input = this->_node_map.get_node(name);
+    if (!input || input->type != GateType::INPUT) {
+      throw std::invalid_argument("Unknown input " + name);
+    }
+    if (input->is_key_input) {
+      throw std::invalid_argument("Cannot enumerate key input " + name);
+    }
+    // a repeated name is enumerated once and counts once towards the limit
+    if (std::find(enumerated.begin(), enumerated.end(), input) == enumerated.end()) enumerated.push_back(input);
+  }
+  if (enumerated.empty()) {
+    for (const auto& input: this->_node_map.inputs) {
+      if (!input->is_key_input) enumerated.push_back(input);
+    }
+    if (enumerated.size() > this->_options.exhaustive_threshold) return;
+  }
+  if (enumerated.size() > 31) {
+    throw std::invalid_argument("Cannot enumerate more than 31 inputs");
+  }
+  for (const auto& input: enumerated) this->_gray_bit.insert(std::make_pair(input, (u_int32_t)this->_gray_bit.size()));
+  this->_rounds = 1U << this->_gray_bit.size();
+  std::cout << "Enumerating all " << this->_rounds << " patterns of " << this->_gray_bit.size() << " inputs" << std::endl;
+}
+
+void FaultImpactAnalysis::simulate_good() {
+  const core::FlatNetlist& netlist = *this->_netlist;
+  const std::size_t block = netlist.size() * simd::kernels().words;
+  const std::size_t input_block = netlist.inputs.size() * simd::kernels().words;
+  this->_good.clear();
+  if (!this->keeps_batches()) return;
+  this->_good.assign(this->batches() * block, 0);
+  std::vector<u_int64_t> evaluations(this->batches(), 0);
+  this->_pool->run(this->batches(), [&](std::size_t batch, std::size_t) {
+    ParallelSim sim(netlist);
+    sim.set_input(std::vector<u_int64_t>(this->_patterns.begin() + batch * input_block, this->_patterns.begin() + (batch + 1) * input_block));
+    sim.run();
+    std::copy(sim.get_values().begin(), sim.get_values().end(), this->_good.begin() + batch * block);
+    evaluations[batch] = sim.evaluations();
+  });
+  core::metrics().add("gate_evaluations", std::accumulate(evaluations.begin(), evaluations.end(), (u_int64_t)0), "analysis");
+}
+
+/**
+ * @brief Output fault of a gate that is equivalent to a stuck-at fault on a fanin driving nothing else, -1 if none.
+ * A controlling value on the fanin fixes the output, a BUF or NOT passes either value on.
+ */
+static int equivalent_output_fault(GateType type, int stuck) {
+  switch (type) {
     case GateType::BUF:
-      this->_values[node] = this->_values[node->inputs[0]];
-      break;
+      return stuck;
+    case GateType::NOT:
+      return 1 - stuck;
     case GateType::AND:
-      this->_values[node] = std::all_of(node->inputs.begin(), node->inputs.end(), [this](core::Node* n) { return this->_values[n]; }) ? FLL_TRUE : FLL_FALSE;
-      break;
+      return stuck == 0 ? 0 : -1;
     case GateType::NAND:
-      this->_values[node] = std::all_of(node->inputs.begin(), node->inputs.end(), [this](core::Node* n) { return this->_values[n]; }) ? FLL_FALSE : FLL_TRUE;
-      break;
+      return stuck == 0 ? 1 : -1;
     case GateType::OR:
-      this->_values[node] = std::any_of(node->inputs.begin(), node->inputs.end(), [this](core::Node* n) { return this->_values[n]; }) ? FLL_TRUE : FLL_FALSE;
-      break;
+      return stuck == 1 ? 1 : -1;
     case GateType::NOR:
-      this->_values[node] = std::any_of(node->inputs.begin(), node->inputs.end(), [this](core::Node* n) { return this->_values[n]; }) ? FLL_FALSE : FLL_TRUE;
-      break;
-    case GateType::XOR:
-      this->_values[node] = std::accumulate(
-        node->inputs.begin(), node->inputs.end(), FLL_FALSE,
-        [this](FLL_Node_Value cur, core::Node* next) { return cur == this->_values[next] ? FLL_FALSE : FLL_TRUE; });
-      break;
-    case GateType::XNOR:
-      this->_values[node] = std::accumulate(
-        node->inputs.begin(), node->inputs.end(), FLL_FALSE,
-        [this](FLL_Node_Value cur, core::Node* next) { return cur == this->_values[next] ? FLL_TRUE : FLL_FALSE; });
-      break;
+      return stuck == 1 ? 0 : -1;
     default:
-      break;
+      return -1;
   }
-  // std::cout << node->name << " = " << this->_values[node] << std::endl;
 }
 
-void Sim::run() {
-  // do sanity check before starting simulation
-  if (std::any_of(this->_node_map.inputs.begin(), this->_node_map.inputs.end(), [this](core::Node* n) { return this->_values[n] == FLL_UNKNOWN; })) {
-    throw std::runtime_error("Circuit has unknown inputs");
+void FaultImpactAnalysis::collapse() {
+  this->_representative.clear();
+  // the histogram counts every fault, not every class
+  if (!this->_options.collapse_faults || !this->_output_hits.empty()) return;
+  const core::FlatNetlist& netlist = *this->_netlist;
+  const u_int32_t n = netlist.size();
+  std::vector<char> is_output(n, 0);
+  for (const auto& output: netlist.outputs) is_output[output] = 1;
+  this->_representative.resize(2 * n);
+  std::iota(this->_representative.begin(), this->_representative.end(), 0);
+  u_int32_t collapsed = 0;
+  // a fault is only equivalent to a fault of its gate if nothing else observes the node,
+  // fanouts have a higher index so that fault is already resolved
+  for (u_int32_t i = n; i-- > 0;) {
+    if (is_output[i] || netlist.fanout_count(i) != 1) continue;
+    const u_int32_t gate = netlist.fanout_begin(i)[0];
+    for (int stuck = 0; stuck < 2; ++stuck) {
+      const int output = equivalent_output_fault(netlist.types[gate], stuck);
+      if (output < 0) continue;
+      this->_representative[2 * i + stuck] = this->_representative[2 * gate + output];
+      ++collapsed;
+    }
+  }
+  std::cout << "Collapsed " << collapsed << " of " << 2 * n << " stuck-at faults" << std::endl;
+}
+
+void FaultImpactAnalysis::simulate(const std::vector<core::Node*>& sites, u_int32_t first, u_int32_t last) {
+  if (sites.empty() || first >= last) return;
+  const core::FlatNetlist& netlist = *this->_netlist;
+  // one fault per equivalence class, fault `2 * i + v` of the sites is `faults[position[2 * i + v]]`
+  std::vector<StuckAtFault> faults;
+  std::vector<u_int32_t> position(2 * sites.size());
+  std::unordered_map<u_int32_t, u_int32_t> simulated;
+  for (std::size_t i = 0; i < sites.size(); ++i) {
+    const u_int32_t index = netlist.index_of(sites[i]);
+    for (int stuck = 0; stuck < 2; ++stuck) {
+      const u_int32_t fault = this->_representative.empty() ? 2 * index + stuck : this->_representative[2 * index + stuck];
+      const auto entry = simulated.emplace(fault, (u_int32_t)faults.size());
+      if (entry.second) faults.push_back(StuckAtFault{ fault / 2, fault % 2 ? FLL_TRUE : FLL_FALSE });
+      position[2 * i + stuck] = entry.first->second;
+    }
+  }
+  core::metrics().add("patterns", last - first, "analysis");
+  core::metrics().add("fault_sites", sites.size(), "analysis");
+  core::metrics().add("faults", faults.size(), "analysis");
+  std::vector<unsigned long> nop(faults.size(), 0), noo(faults.size(), 0);
+  if (this->_engine == Engine::SCALAR) {
+    this->run_scalar(faults, first, last, nop, noo);
   }
+  else if (this->_engine == Engine::FAULT_PARALLEL) {
+    this->run_fault_parallel(faults, first, last, nop, noo);
+  }
+  else {
+    this->run_parallel(faults, first, last, nop, noo);
+  }
+  // every fault of a class gets the counters of the class
+  for (std::size_t i = 0; i < sites.size(); ++i) {
+    unsigned long site_nop[2], site_noo[2];
+    std::tie(site_nop[0], site_noo[0], site_nop[1], site_noo[1]) = this->_fault_impact[sites[i]];
+    for (int stuck = 0; stuck < 2; ++stuck) {
+      site_nop[stuck] += nop[position[2 * i + stuck]];
+      site_noo[stuck] += noo[position[2 * i + stuck]];
+    }
+    this->_fault_impact[sites[i]] = std::make_tuple(site_nop[0], site_noo[0], site_nop[1], site_noo[1]);
+  }
+}
+
+std::vector<core::Node*> FaultImpactAnalysis::all_sites() const {
+  std::vector<core::Node*> sites;
+  for (const auto& node: this->_netlist->nodes) {
+    if (this->_fault_impact.count(node)) sites.push_back(node);
+  }
+  return sites;
+}
+
+bool FaultImpactAnalysis::adaptive() const {
+  // enumerated patterns are not a random sample, the bounds would not hold
+  return this->_options.adaptive && this->_gray_bit.empty();
+}
+
+/**
+ * @brief Confidence interval of the mean of `n` samples in `[0, range]` whose variance is at most
+ * `range` times their mean, from Bernstein's inequality with `log_term = ln(2 / delta)`
+ */
+static void bernstein_interval(double mean, double range, double log_term, double n, double& lower, double& upper) {
+  // |mean - x| <= sqrt(a * x) + b, solved for x
+  const double a = 2 * range * log_term / n;
+  const double b = 2 * range * log_term / (3 * n);
+  const double high = (std::sqrt(a) + std::sqrt(a + 4 * (mean + b))) / 2;
+  upper = std::min(range, high * high);
+  if (mean <= b) {
+    lower = 0;
+    return;
+  }
+  const double low = (std::sqrt(a + 4 * (mean - b)) - std::sqrt(a)) / 2;
+  lower = std::min(range, low * low);
+}
 
-  // initialize DFS
-  std::stack<core::Node*> s;
-  for (const auto& output: this->_node_map.outputs)
-    s.push(output);
+/**
+ * @brief Whether a node can still get a key gate, the same nodes `pick_batch` considers
+ */
+static bool lockable(const core::Node* node) {
+  return !node->has_locked && !node->is_lock && !node->is_key_input;
+}
 
-  while (!s.empty()) {
-    core::Node* node = s.top();
-    // std::cout << node->name << std::endl;
-    s.pop();
-    if (std::all_of(node->inputs.begin(), node->inputs.end(), [this](core::Node* n) { return this->_values[n] != FLL_UNKNOWN; })) {
-      this->run_node(node);
+bool FaultImpactAnalysis::settled() const {
+  const core::FlatNetlist& netlist = *this->_netlist;
+  const u_int32_t n = netlist.size();
+  // per-pattern NoO of a fault is at most the outputs reachable from it, counted with their multiplicity
+  std::vector<double> range(n, 0);
+  for (const auto& output: netlist.outputs) range[output] += 1;
+  for (u_int32_t i = n; i-- > 0;) {
+    for (u_int32_t k = 0; k < netlist.fanout_count(i); ++k) range[i] += range[netlist.fanout_begin(i)[k]];
+    range[i] = std::min<double>(range[i], netlist.outputs.size());
+  }
+  struct Bounds {
+    double estimate, lower, upper;
+  };
+  std::vector<Bounds> candidates;
+  for (u_int32_t i = 0; i < n; ++i) {
+    if (!lockable(netlist.nodes[i])) continue;
+    auto entry = this->_fault_impact.find(netlist.nodes[i]);
+    if (entry == this->_fault_impact.end()) continue;
+    candidates.push_back(Bounds{ 0, 0, 0 });
+    unsigned long counts[4];
+    std::tie(counts[0], counts[1], counts[2], counts[3]) = entry->second;
+    for (int stuck = 0; stuck < 2; ++stuck) {
+      const double nop = (double)counts[2 * stuck] / this->_simulated;
+      const double noo = (double)counts[2 * stuck + 1] / this->_simulated;
+      candidates.back().estimate += nop * noo;
     }
-    else {
-      s.push(node);
-      for (const auto& input: node->inputs) {
-        if (this->_values[input] == FLL_UNKNOWN) {
-          s.push(input);
-        }
-      }
+  }
+  const std::size_t k = std::max<std::size_t>(1, this->_options.batch_size);
+  if (candidates.size() <= k) return true;
+
+  // every bound holds at once, for every candidate and every check up to the last round
+  const double checks = std::ceil((double)this->_rounds / std::max<u_int32_t>(1, this->_options.adaptive_step));
+  const double delta = (1 - this->_options.confidence) / (4 * candidates.size() * checks);
+  const double log_term = std::log(2 / delta);
+  std::size_t c = 0;
+  for (u_int32_t i = 0; i < n; ++i) {
+    if (!lockable(netlist.nodes[i])) continue;
+    auto entry = this->_fault_impact.find(netlist.nodes[i]);
+    if (entry == this->_fault_impact.end()) continue;
+    unsigned long counts[4];
+    std::tie(counts[0], counts[1], counts[2], counts[3]) = entry->second;
+    for (int stuck = 0; stuck < 2; ++stuck) {
+      double nop[2], noo[2];
+      bernstein_interval((double)counts[2 * stuck] / this->_simulated, 1, log_term, this->_simulated, nop[0], nop[1]);
+      bernstein_interval((double)counts[2 * stuck + 1] / this->_simulated, std::max(range[i], 1.0), log_term, this->_simulated, noo[0], noo[1]);
+      candidates[c].lower += nop[0] * noo[0];
+      candidates[c].upper += nop[1] * noo[1];
     }
+    ++c;
+  }
+  // the top `k` by estimate against the best of the rest
+  std::nth_element(candidates.begin(), candidates.begin() + (k - 1), candidates.end(), [](const Bounds& a, const Bounds& b) {
+    return a.estimate > b.estimate;
+  });
+  double top_lower = candidates[0].lower, top_estimate = candidates[0].estimate;
+  for (std::size_t i = 1; i < k; ++i) {
+    top_lower = std::min(top_lower, candidates[i].lower);
+    top_estimate = std::min(top_estimate, candidates[i].estimate);
   }
+  double rest_upper = 0;
+  for (std::size_t i = k; i < candidates.size(); ++i) rest_upper = std::max(rest_upper, candidates[i].upper);
+  return rest_upper - top_lower <= this->_options.tolerance * top_estimate;
 }
 
-void FaultImpactAnalysis::run(u_int32_t rounds,u_int64_t seed) {
+void FaultImpactAnalysis::advance() {
+  const std::vector<core::Node*> sites = this->all_sites();
+  if (!this->adaptive()) {
+    this->simulate(sites, this->_simulated, this->_rounds);
+    this->_simulated = this->_rounds;
+    return;
+  }
+  const u_int32_t step = std::max<u_int32_t>(1, this->_options.adaptive_step);
+  while (this->_simulated < this->_rounds && (this->_simulated == 0 || !this->settled())) {
+    const u_int32_t next = std::min<u_int32_t>(this->_rounds, this->_simulated + step);
+    this->simulate(sites, this->_simulated, next);
+    this->_simulated = next;
+  }
+  std::cout << "Used " << this->_simulated << " of " << this->_rounds << " patterns" << std::endl;
+}
+
+void FaultImpactAnalysis::rank() {
+  std::cout << "Calulating fault impact" << std::endl;
+  this->_res.clear();
+  // collect in netlist order, so ties rank the same way in every run
+  for (const auto& node: this->_netlist->nodes) {
+    auto entry = this->_fault_impact.find(node);
+    if (entry == this->_fault_impact.end()) continue;
+    unsigned long nop0, noo0, nop1, noo1;
+    std::tie(nop0, noo0, nop1, noo1) = entry->second;
+    this->_res.push_back(std::make_pair(entry->first, nop0 * noo0 + nop1 * noo1));
+  }
+  std::cout << "Sorting results" << std::endl;
+  std::stable_sort(this->_res.begin(), this->_res.end(), [](const FaultImpactResultValuePair& a, const FaultImpactResultValuePair& b) {
+    return a.second > b.second;
+  });
+  std::cout << "Done." << std::endl;
+}
+
+void FaultImpactAnalysis::run(u_int32_t rounds, u_int64_t seed) {
+  core::PhaseTimer timer("analysis");
   std::cout << "Running fault impact analysis" << std::endl;
-  std::srand(seed);
-  for (unsigned long i = 0; i < rounds; ++i) {
-    std::cout << "\rIteration: " << i + 1 << " / 1000";
-    std::cout.flush();
-    // prepare input
-    SimulationValues inputs(this->_node_map.inputs.size());
-    for (unsigned long j = 0; j < this->_node_map.inputs.size(); ++j) {
-      inputs[j] = std::rand() % 2 == 1 ? FLL_TRUE : FLL_FALSE;
+  this->select_patterns(rounds);
+  this->_seed = seed;
+  if (this->_options.base_netlist && !this->_netlist) {
+    this->_netlist.reset(new core::FlatNetlist(*this->_options.base_netlist, this->_node_map));
+  }
+  else {
+    this->_netlist.reset(new core::FlatNetlist(this->_node_map));
+  }
+  this->_engine = this->_options.engine;
+  if (this->_engine == Engine::AUTO) {
+    // patterns are simulated a step at a time in adaptive mode
+    const u_int32_t patterns = this->adaptive() ? std::min(this->_rounds, this->_options.adaptive_step) : this->_rounds;
+    this->_engine = patterns < simd::kernels().words * 64 ? Engine::FAULT_PARALLEL : Engine::PATTERN_PARALLEL;
+  }
+  this->draw_patterns();
+  this->_output_hits.assign(this->_options.output_histogram ? this->_netlist->size() : 0, 0);
+  this->collapse();
+  for (auto& entry: this->_fault_impact) entry.second = std::make_tuple(0, 0, 0, 0);
+  if (this->_engine != Engine::SCALAR) this->simulate_good();
+  this->_simulated = 0;
+  this->advance();
+  // every output once, the hits of an output listed twice are counted twice already
+  this->_output_histogram.clear();
+  if (!this->_output_hits.empty()) {
+    std::vector<char> listed(this->_netlist->size(), 0);
+    for (const auto& output: this->_netlist->outputs) {
+      if (listed[output]) continue;
+      listed[output] = 1;
+      this->_output_histogram.push_back(std::make_pair(this->_netlist->nodes[output], this->_output_hits[output]));
+    }
+    this->_output_hits.clear();
+  }
+  this->rank();
+}
+
+void FaultImpactAnalysis::update() {
+  if (!this->_netlist) {
+    throw std::logic_error("Fault impact analysis has not been run");
+  }
+  for (core::NodeId id = 0; id < this->_node_map.size(); ++id) {
+    this->_fault_impact.insert(std::make_pair(this->_node_map.node(id), std::make_tuple(0, 0, 0, 0)));
+  }
+  core::PhaseTimer timer("analysis");
+  std::cout << "Updating fault impact analysis" << std::endl;
+  if (this->_engine == Engine::SCALAR) {
+    // without fault-free values to reuse every site is simulated again, on the patterns used so far
+    this->_netlist.reset(new core::FlatNetlist(this->_node_map));
+    this->collapse();
+    this->draw_patterns();
+    for (auto& entry: this->_fault_impact) entry.second = std::make_tuple(0, 0, 0, 0);
+    this->simulate(this->all_sites(), 0, this->_simulated);
+    this->advance();
+    this->rank();
+    return;
+  }
+  std::unique_ptr<core::FlatNetlist> old(new core::FlatNetlist(this->_node_map));
+  old.swap(this->_netlist);
+  this->collapse();
+  const core::FlatNetlist& netlist = *this->_netlist;
+  const u_int32_t n = netlist.size();
+  std::vector<unsigned long> output_count(n, 0), old_output_count(old->size(), 0);
+  for (const auto& output: netlist.outputs) ++output_count[output];
+  for (const auto& output: old->outputs) ++old_output_count[output];
+
+  // position of every primary input, it selects the pattern stream of the input
+  std::vector<u_int32_t> input_position(n, UINT32_MAX), old_input_position(old->size(), UINT32_MAX);
+  for (u_int32_t j = 0; j < netlist.inputs.size(); ++j) input_position[netlist.inputs[j]] = j;
+  for (u_int32_t j = 0; j < old->inputs.size(); ++j) old_input_position[old->inputs[j]] = j;
+
+  // a node changed if it is new or rewired, or if any of its fanins changed
+  std::vector<u_int32_t> old_index(n, 0);
+  std::vector<char> changed(n, 0);
+  for (u_int32_t i = 0; i < n; ++i) {
+    if (!old->find(netlist.nodes[i], old_index[i])) {
+      changed[i] = 1;
+      continue;
+    }
+    const u_int32_t o = old_index[i];
+    bool same = netlist.types[i] == old->types[o] && netlist.fanin_count(i) == old->fanin_count(o) && output_count[i] == old_output_count[o]
+      && input_position[i] == old_input_position[o];
+    for (u_int32_t k = 0; same && k < netlist.fanin_count(i); ++k) {
+      same = netlist.nodes[netlist.fanin_begin(i)[k]] == old->nodes[old->fanin_begin(o)[k]];
+    }
+    if (!same) changed[i] = 1;
+  }
+  // fanouts always have a higher index, so one ascending pass closes the cone
+  for (u_int32_t i = 0; i < n; ++i) {
+    if (!changed[i]) continue;
+    for (u_int32_t k = 0; k < netlist.fanout_count(i); ++k) changed[netlist.fanout_begin(i)[k]] = 1;
+  }
+  // a fault site is simulated again if its fanout cone reaches a changed node
+  std::vector<char> affected(changed);
+  for (u_int32_t i = n; i-- > 0;) {
+    for (u_int32_t k = 0; !affected[i] && k < netlist.fanout_count(i); ++k) {
+      affected[i] = affected[netlist.fanout_begin(i)[k]];
+    }
+  }
+
+  // keep the fault-free values outside the changed cone, evaluate the rest in topological order
+  this->draw_patterns();
+  if (this->keeps_batches()) {
+    const simd::Kernels& kernels = simd::kernels();
+    const std::size_t words = kernels.words;
+    std::vector<u_int64_t> good(this->batches() * n * words, 0);
+    std::vector<u_int64_t> evaluations(this->batches(), 0);
+    this->_pool->run(this->batches(), [&](std::size_t batch, std::size_t) {
+      u_int64_t* values = &good[batch * n * words];
+      const u_int64_t* old_values = &this->_good[batch * old->size() * words];
+      const u_int64_t* inputs = &this->_patterns[batch * netlist.inputs.size() * words];
+      for (u_int32_t i = 0; i < n; ++i) {
+        if (!changed[i]) {
+          std::copy(old_values + old_index[i] * words, old_values + (old_index[i] + 1) * words, values + i * words);
+        }
+        else if (input_position[i] != UINT32_MAX) {
+          std::copy(inputs + input_position[i] * words, inputs + (input_position[i] + 1) * words, values + i * words);
+        }
+        else if (netlist.fanin_count(i) != 0) {
+          kernels.eval(netlist.types[i], netlist.fanin_begin(i), netlist.fanin_count(i), values, i);
+          ++evaluations[batch];
+        }
+      }
+    });
+    core::metrics().add("gate_evaluations", std::accumulate(evaluations.begin(), evaluations.end(), (u_int64_t)0), "analysis");
+    this->_good.swap(good);
+  }
+
+  std::vector<core::Node*> sites;
+  for (u_int32_t i = 0; i < n; ++i) {
+    if (affected[i] && this->_fault_impact.count(netlist.nodes[i])) sites.push_back(netlist.nodes[i]);
+  }
+  std::cout << "Simulating " << sites.size() << " of " << this->_fault_impact.size() << " fault sites again" << std::endl;
+  for (const auto& site: sites) {
+    this->_fault_impact[site] = std::make_tuple(0, 0, 0, 0);
+  }
+  // the sites simulated again see the patterns used so far, the ranking may ask for more
+  this->simulate(sites, 0, this->_simulated);
+  this->advance();
+  this->rank();
+}
+
+/**
+ * @brief Pack the values of the primary outputs into a signature, bit `p` is output `p`
+ */
+static void pack_outputs(const core::FlatNetlist& netlist, const SimulationValues& values, std::vector<u_int64_t>& signature) {
+  std::fill(signature.begin(), signature.end(), 0);
+  for (std::size_t p = 0; p < netlist.outputs.size(); ++p) {
+    if (values[netlist.outputs[p]] == FLL_TRUE) signature[p / 64] |= 1ULL << (p % 64);
+  }
+}
+
+void FaultImpactAnalysis::run_scalar(const std::vector<StuckAtFault>& faults, u_int32_t first, u_int32_t last,
+                                     std::vector<unsigned long>& nop, std::vector<unsigned long>& noo) {
+  const core::FlatNetlist& netlist = *this->_netlist;
+  const std::size_t words = simd::kernels().words;
+  const std::size_t n_inputs = this->_node_map.inputs.size();
+  const std::size_t n_signature = (netlist.outputs.size() + 63) / 64;
+  // output responses as packed signatures, a differing output is a set bit of their XOR
+  std::vector<u_int64_t> good(n_signature), faulty(n_signature);
+  // both simulations are event-driven, the fault-free one follows the inputs that change from
+  // pattern to pattern, and every faulty one only evaluates what its fault changes
+  Sim orig(netlist, true);
+  Sim fault(netlist, true);
+  std::vector<u_int64_t> scratch;
+  const u_int64_t* batch = nullptr;
+  core::Progress progress("Iteration", last - first);
+  for (unsigned long i = first; i < last; ++i) {
+    progress.update(i - first);
+    // prepare input, bit `i` of the drawn patterns
+    if (batch == nullptr || i % (words * 64) == 0) batch = this->batch_patterns(i / (words * 64), scratch);
+    const std::size_t lane = i % (words * 64);
+    SimulationValues inputs(n_inputs);
+    for (unsigned long j = 0; j < n_inputs; ++j) {
+      inputs[j] = (batch[j * words + lane / 64] >> (lane % 64)) & 1 ? FLL_TRUE : FLL_FALSE;
     }
 
     // run simulation without fault
-    Sim orig(this->_node_map);
     orig.set_input(inputs);
     orig.run();
-    SimulationValues orig_outputs(this->_node_map.outputs.size());
-    for (const auto& output: this->_node_map.outputs) {
-      orig_outputs.push_back(orig.get_values()[output]);
-    }
-    // for (const auto& output: orig_outputs) {
-    //   std::cout << output << " ";
-    // }
-    // std::cout << std::endl;
-    for (const auto& map_entry: this->_node_map.map) {
-      unsigned long nop0, noo0, nop1, noo1;
-      std::tie(nop0, noo0, nop1, noo1) = this->_fault_impact[map_entry.second];
-      // run simulation with stuck at 0
-      Sim fault0(this->_node_map);
-      fault0.set_input(inputs);
-      fault0.set_fault(map_entry.second, FLL_FALSE);
-      fault0.run();
-      SimulationValues fault0_outputs(this->_node_map.outputs.size());
-      for (const auto& output: this->_node_map.outputs) {
-        fault0_outputs.push_back(fault0.get_values()[output]);
-      }
-      // for (const auto& output: fault0_outputs) {
-      //   std::cout << output << " ";
-      // }
-      // std::cout << std::endl;
-      // run simulation with stuck at 1
-      Sim fault1(this->_node_map);
-      fault1.set_input(inputs);
-      fault1.set_fault(map_entry.second, FLL_TRUE);
-      fault1.run();
-      SimulationValues fault1_outputs(this->_node_map.outputs.size());
-      for (const auto& output: this->_node_map.outputs) {
-        fault1_outputs.push_back(fault1.get_values()[output]);
-      }
-      // for (const auto& output: fault1_outputs) {
-      //   std::cout << output << " ";
-      // }
-      // std::cout << std::endl;
+    pack_outputs(netlist, orig.get_values(), good);
+    for (std::size_t f = 0; f < faults.size(); ++f) {
+      // run simulation with the stuck-at fault
+      fault.load(orig);
+      fault.set_fault(netlist.nodes[faults[f].index], faults[f].value);
+      fault.run();
+      pack_outputs(netlist, fault.get_values(), faulty);
       // calculate fault impact
-      SimulationValues diff0(this->_node_map.outputs.size());
-      SimulationValues diff1(this->_node_map.outputs.size());
-      auto it0 = std::set_difference(orig_outputs.begin(), orig_outputs.end(), fault0_outputs.begin(), fault0_outputs.end(), diff0.begin());
-      auto it1 = std::set_difference(orig_outputs.begin(), orig_outputs.end(), fault1_outputs.begin(), fault1_outputs.end(), diff1.begin());
-      diff0.resize(it0 - diff0.begin());
-      diff1.resize(it1 - diff1.begin());
-      // std::cout << "diff0: " << diff0.size() << " diff1: " << diff1.size() << std::endl;
-      if (diff0.size() > 0) {
-        nop0 += 1; noo0 += diff0.size();
+      unsigned long differing = 0;
+      for (std::size_t w = 0; w < n_signature; ++w) {
+        u_int64_t diff = good[w] ^ faulty[w];
+        differing += __builtin_popcountll(diff);
+        if (this->_output_hits.empty()) continue;
+        for (; diff != 0; diff &= diff - 1) ++this->_output_hits[netlist.outputs[w * 64 + __builtin_ctzll(diff)]];
       }
-      if (diff1.size() > 0) {
-        nop1 += 1; noo1 += diff1.size();
+      if (differing > 0) {
+        nop[f] += 1; noo[f] += differing;
       }
-      this->_fault_impact[map_entry.second] = std::make_tuple(nop0, noo0, nop1, noo1);
     }
   }
-  std::cout << std::endl;
-  std::cout << "Calulating fault impact" << std::endl;
-  for (const auto& entry: this->_fault_impact) {
-    unsigned long nop0, noo0, nop1, noo1;
-    std::tie(nop0, noo0, nop1, noo1) = entry.second;
-    this->_res.push_back(std::make_pair(entry.first, nop0 * noo0 + nop1 * noo1));
+  progress.finish();
+  core::metrics().add("gate_evaluations", orig.evaluations() + fault.evaluations(), "analysis");
+}
+
+/**
+ * @brief Per-thread state of the parallel engines. Counters are per simulated fault
+ * and summed once all threads are done.
+ */
+struct AnalysisWorker {
+  ParallelSim sim;
+  // batch whose fault-free values are in `sim`
+  std::size_t batch;
+  std::vector<unsigned long> nop;
+  std::vector<unsigned long> noo;
+  std::vector<u_int64_t> detected;
+  // corruptions per netlist index, empty unless the output histogram is collected
+  std::vector<unsigned long> hits;
+  // patterns of `batch` when they are not kept
+  std::vector<u_int64_t> inputs;
+  AnalysisWorker(const core::FlatNetlist& netlist, std::size_t n_faults, bool histogram)
+    : sim(netlist), batch(SIZE_MAX), nop(n_faults, 0), noo(n_faults, 0), detected(sim.words(), 0),
+      hits(histogram ? netlist.size() : 0, 0) { }
+};
+
+void FaultImpactAnalysis::load_batch(AnalysisWorker& worker, std::size_t batch) const {
+  if (worker.batch == batch) return;
+  worker.sim.clear_fault();
+  if (this->_good.empty()) {
+    // the fault-free values of a batch that is not kept are simulated where they are needed
+    worker.inputs.resize(this->_node_map.inputs.size() * worker.sim.words());
+    this->fill_patterns(batch, worker.inputs.data());
+    worker.sim.set_input(worker.inputs);
+    worker.sim.run();
   }
-  std::cout << "Sorting results" << std::endl;
-  std::sort(this->_res.begin(), this->_res.end(), [](const FaultImpactResultValuePair& a, const FaultImpactResultValuePair& b) {
-    return a.second > b.second;
+  else {
+    worker.sim.set_values(&this->_good[batch * this->_netlist->size() * worker.sim.words()]);
+  }
+  worker.batch = batch;
+}
+
+void FaultImpactAnalysis::merge(const std::vector<std::unique_ptr<AnalysisWorker>>& workers, std::vector<unsigned long>& nop,
+                                std::vector<unsigned long>& noo) {
+  u_int64_t evaluations = 0;
+  for (const auto& worker: workers) {
+    if (!worker) continue;
+    for (std::size_t f = 0; f < nop.size(); ++f) {
+      nop[f] += worker->nop[f];
+      noo[f] += worker->noo[f];
+    }
+    evaluations += worker->sim.evaluations();
+    for (std::size_t i = 0; i < worker->hits.size(); ++i) this->_output_hits[i] += worker->hits[i];
+  }
+  core::metrics().add("gate_evaluations", evaluations, "analysis");
+}
+
+void FaultImpactAnalysis::run_parallel(const std::vector<StuckAtFault>& faults, u_int32_t first, u_int32_t last,
+                                       std::vector<unsigned long>& nop, std::vector<unsigned long>& noo) {
+  const core::FlatNetlist& netlist = *this->_netlist;
+  core::ThreadPool& pool = *this->_pool;
+  const std::size_t words = simd::kernels().words;
+  const std::size_t lanes = words * 64;
+  // batches holding patterns `[first, last)`
+  const std::size_t first_batch = first / lanes;
+  const std::size_t n_batches = (last + lanes - 1) / lanes - first_batch;
+  // number of times every node appears in the output list
+  std::vector<unsigned long> output_count(netlist.size(), 0);
+  for (const auto& output: netlist.outputs) ++output_count[output];
+
+  // a task is a range of faults under one batch, enough of them to keep every thread busy
+  const std::size_t chunks = std::min(faults.size(), std::max<std::size_t>(1, (4 * pool.size() + n_batches - 1) / n_batches));
+  const std::size_t chunk_size = (faults.size() + chunks - 1) / chunks;
+  std::vector<std::unique_ptr<AnalysisWorker>> workers(pool.size());
+  std::cout << "Simulating " << lanes << " patterns per pass on " << pool.size() << " threads" << std::endl;
+  // tasks are claimed in order, so the task index tells how far the pool got
+  core::Progress progress("Task", n_batches * chunks);
+  pool.run(n_batches * chunks, [&](std::size_t task, std::size_t thread) {
+    if (thread == 0) progress.update(task);
+    if (!workers[thread]) workers[thread].reset(new AnalysisWorker(netlist, faults.size(), !this->_output_hits.empty()));
+    AnalysisWorker& worker = *workers[thread];
+    const std::size_t batch = first_batch + task / chunks;
+    // fault-free values of the batch are kept for all of its faults
+    this->load_batch(worker, batch);
+    // lanes of the batch in `[first, last)`
+    const std::size_t low = std::max<std::size_t>(first, batch * lanes) - batch * lanes;
+    const std::size_t high = std::min<std::size_t>(last, (batch + 1) * lanes) - batch * lanes;
+    std::vector<u_int64_t> mask(words);
+    for (std::size_t w = 0; w < words; ++w) {
+      const std::size_t from = std::min<std::size_t>(64, low - std::min(low, w * 64));
+      const std::size_t to = std::min<std::size_t>(64, high - std::min(high, w * 64));
+      mask[w] = (to == 64 ? ~0ULL : (1ULL << to) - 1) & ~(from == 64 ? ~0ULL : (1ULL << from) - 1);
+    }
+
+    const std::size_t begin = (task % chunks) * chunk_size;
+    for (std::size_t f = begin; f < std::min(faults.size(), begin + chunk_size); ++f) {
+      // a pattern counts once if any output differs, every differing output adds to NoO
+      std::fill(worker.detected.begin(), worker.detected.end(), 0);
+      for (const auto& changed: worker.sim.run_fault(faults[f].index, faults[f].value)) {
+        if (output_count[changed] == 0) continue;
+        const u_int64_t* orig = worker.sim.get_value(changed);
+        const u_int64_t* value = worker.sim.get_faulty_value(changed);
+        unsigned long differing = 0;
+        for (std::size_t w = 0; w < words; ++w) {
+          u_int64_t diff = (value[w] ^ orig[w]) & mask[w];
+          worker.detected[w] |= diff;
+          differing += __builtin_popcountll(diff);
+        }
+        worker.noo[f] += output_count[changed] * differing;
+        if (!worker.hits.empty()) worker.hits[changed] += output_count[changed] * differing;
+      }
+      for (std::size_t w = 0; w < words; ++w) {
+        worker.nop[f] += __builtin_popcountll(worker.detected[w]);
+      }
+    }
   });
-  std::cout << "Done." << std::endl;
+  progress.finish();
+  this->merge(workers, nop, noo);
 }
 
-void lock_n_gates(core::NodeMap& map, std::size_t keyBits, u_int32_t rounds, u_int64_t seed) {
+void FaultImpactAnalysis::run_fault_parallel(const std::vector<StuckAtFault>& faults, u_int32_t first, u_int32_t last,
+                                             std::vector<unsigned long>& nop, std::vector<unsigned long>& noo) {
+  const core::FlatNetlist& netlist = *this->_netlist;
+  core::ThreadPool& pool = *this->_pool;
+  const std::size_t words = simd::kernels().words;
+  const std::size_t lanes = words * 64;
+  const std::size_t first_batch = first / lanes;
+  const std::size_t n_batches = (last + lanes - 1) / lanes - first_batch;
+  std::vector<unsigned long> output_count(netlist.size(), 0);
+  for (const auto& output: netlist.outputs) ++output_count[output];
+
+  // a task is a range of patterns of one batch, all fault groups are simulated for each pattern
+  const std::size_t chunks = std::min(lanes, std::max<std::size_t>(1, (4 * pool.size() + n_batches - 1) / n_batches));
+  const std::size_t chunk_size = (lanes + chunks - 1) / chunks;
+  std::vector<std::unique_ptr<AnalysisWorker>> workers(pool.size());
+  std::cout << "Simulating " << lanes << " faults per pass on " << pool.size() << " threads" << std::endl;
+  // tasks are claimed in order, so the task index tells how far the pool got
+  core::Progress progress("Task", n_batches * chunks);
+  pool.run(n_batches * chunks, [&](std::size_t task, std::size_t thread) {
+    if (thread == 0) progress.update(task);
+    if (!workers[thread]) workers[thread].reset(new AnalysisWorker(netlist, faults.size(), !this->_output_hits.empty()));
+    AnalysisWorker& worker = *workers[thread];
+    const std::size_t batch = first_batch + task / chunks;
+    this->load_batch(worker, batch);
+    const std::size_t low = std::max<std::size_t>(first, batch * lanes) - batch * lanes;
+    const std::size_t high = std::min<std::size_t>(last, (batch + 1) * lanes) - batch * lanes;
+    const std::size_t begin = (task % chunks) * chunk_size;
+    for (std::size_t pattern = std::max(low, begin); pattern < std::min(high, begin + chunk_size); ++pattern) {
+      worker.sim.load_pattern(pattern);
+      for (std::size_t group = 0; group < faults.size(); group += lanes) {
+        const std::size_t count = std::min(lanes, faults.size() - group);
+        std::fill(worker.detected.begin(), worker.detected.end(), 0);
+        for (const auto& changed: worker.sim.run_faults(&faults[group], count)) {
+          if (output_count[changed] == 0) continue;
+          const u_int64_t orig = 0 - ((worker.sim.get_value(changed)[pattern / 64] >> (pattern % 64)) & 1);
+          const u_int64_t* value = worker.sim.get_faulty_value(changed);
+          for (std::size_t w = 0; w < words; ++w) {
+            u_int64_t diff = value[w] ^ orig;
+            worker.detected[w] |= diff;
+            if (!worker.hits.empty()) worker.hits[changed] += output_count[changed] * __builtin_popcountll(diff);
+            // every set lane is a fault corrupting this output
+            for (; diff != 0; diff &= diff - 1) {
+              worker.noo[group + w * 64 + __builtin_ctzll(diff)] += output_count[changed];
+            }
+          }
+        }
+        for (std::size_t w = 0; w < words; ++w) {
+          for (u_int64_t lanes_hit = worker.detected[w]; lanes_hit != 0; lanes_hit &= lanes_hit - 1) {
+            ++worker.nop[group + w * 64 + __builtin_ctzll(lanes_hit)];
+          }
+        }
+      }
+    }
+  });
+  progress.finish();
+  this->merge(workers, nop, noo);
+}
+
+/**
+ * @brief Take up to `count` lockable nodes from the ranking of `fia`. A candidate is skipped if more than
+ * `max_overlap` of its fanout cone is shared with the cones picked before it, since locking those would
+ * change its score. The best lockable node is always picked.
+ */
+static std::vector<core::Node*> pick_batch(FaultImpactAnalysis& fia, std::size_t count, double max_overlap) {
+  const core::FlatNetlist& netlist = fia.get_netlist();
+  // union of the picked cones, closed under fanout
+  std::vector<char> claimed(netlist.size(), 0);
+  std::vector<char> in_cone(netlist.size(), 0);
+  std::vector<u_int32_t> cone;
+  std::vector<core::Node*> picked;
+  for (const auto& entry: fia.get_res()) {
+    if (picked.size() == count) break;
+    if (entry.first->has_locked) continue;
+    if (entry.first->is_lock) continue;
+    if (entry.first->is_key_input) continue;
+    const u_int32_t site = netlist.index_of(entry.first);
+    // the cone of a claimed node is claimed as a whole
+    if (claimed[site] && max_overlap < 1.0) continue;
+    cone.assign(1, site);
+    in_cone[site] = 1;
+    std::size_t shared = 0;
+    for (std::size_t k = 0; k < cone.size(); ++k) {
+      if (claimed[cone[k]]) ++shared;
+      for (u_int32_t f = 0; f < netlist.fanout_count(cone[k]); ++f) {
+        const u_int32_t fanout = netlist.fanout_begin(cone[k])[f];
+        if (in_cone[fanout]) continue;
+        in_cone[fanout] = 1;
+        cone.push_back(fanout);
+      }
+    }
+    for (const auto& index: cone) in_cone[index] = 0;
+    if (!picked.empty() && shared > max_overlap * cone.size()) continue;
+    for (const auto& index: cone) claimed[index] = 1;
+    picked.push_back(entry.first);
+  }
+  return picked;
+}
+
+void lock_n_gates(core::NodeMap& map, std::size_t keyBits, u_int32_t rounds, u_int64_t seed, const AnalysisOptions& options) {
   std::cout << "Locking using Fault Analysis-Based Logic Locking" << std::endl;
   // prepare key
-  std::srand(seed);
-  std::size_t nBits = std::min(keyBits, map.map.size());
+  std::size_t nBits = std::min(keyBits, map.size());
   if (nBits != keyBits) {
     std::cerr << "Warning keyBits is larger than the number of lockable nodes." << std::endl;
   }
-  std::vector<bool> key(nBits);
-  std::generate(key.begin(), key.end(), []() { return std::rand() % 2; });
+  std::vector<bool> key = core::random_key(nBits, seed);
   std::cout << "Key: ";
   for (const auto& bit : key) {
     std::cout << (bit ? "1" : "0");
   }
   std::cout << std::endl;
-  // lock nodes
-  for (const auto& bit: key) {
-    // run fault impact analysis
-    FaultImpactAnalysis fia(map);
-    fia.run(rounds, seed);
-    core::Node* node_to_lock = nullptr;
-    for (const auto& entry: fia.get_res()) {
-      if (entry.first->has_locked) continue;
-      if (entry.first->is_lock) continue;
-      if (entry.first->is_key_input) continue;
-      node_to_lock = entry.first;
-      break;
+  // lock nodes in batches, the analysis only re-simulates what the previous batch touched
+  FaultImpactAnalysis fia(map, options);
+  fia.run(rounds, seed);
+  if (options.output_histogram) fia.show_output_histogram();
+  const std::size_t batch_size = std::max<std::size_t>(1, options.batch_size);
+  std::size_t locked = 0;
+  while (locked < key.size()) {
+    if (locked != 0) fia.update();
+    std::vector<core::Node*> picked;
+    {
+      core::PhaseTimer timer("selection");
+      picked = pick_batch(fia, std::min(batch_size, key.size() - locked), options.max_overlap);
+    }
+    if (picked.empty()) {
+      throw std::runtime_error("No lockable node left");
+    }
+    for (const auto& node_to_lock: picked) {
+      std::cout << "Picked " << node_to_lock->name << std::endl;
     }
-    std::cout << "Picked " << node_to_lock->name << std::endl;
-    map.lock_node(node_to_lock, bit);
+    map.lock_nodes(picked, std::vector<bool>(key.begin() + locked, key.begin() + locked + picked.size()), seed);
+    locked += picked.size();
   }
 }
 
-void lock_by_percentage(core::NodeMap& map, float percentage, u_int32_t rounds, u_int64_t seed) {
+void lock_by_percentage(core::NodeMap& map, float percentage, u_int32_t rounds, u_int64_t seed, const AnalysisOptions& options) {
   if (percentage < 0.0 || percentage > 1.0) {
     throw std::invalid_argument("percentage must be between 0.0 and 1.0");
   }
   // this conversion is not perfect, but should be good enough
-  std::size_t nBits = (std::size_t)std::ceil(map.map.size() * percentage);
-  lock_n_gates(map, nBits ,rounds ,seed);
+  std::size_t nBits = (std::size_t)std::ceil(map.size() * percentage);
+  lock_n_gates(map, nBits ,rounds ,seed, options);
 }
 
 }
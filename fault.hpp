@@ -1,7 +1,12 @@
 #pragma once
+#include "netlist.hpp"
 #include "parser.hpp"
+#include "simd.hpp"
+#include <memory>
 #include <tuple>
 
+namespace core { class ThreadPool; }
+
 // Fault Analysis-Based Logic Locking
 namespace FLL {
 
@@ -12,31 +17,54 @@ typedef enum _FLL_Node_Value {
 } FLL_Node_Value;
 
 typedef std::vector<FLL_Node_Value> SimulationValues;
+/**
+ * @brief Scalar simulator, one pattern at a time. In event-driven mode only the first `run`
+ * sweeps the whole circuit. Later inputs and faults schedule the fanouts of the nodes they
+ * change, and `run` evaluates those by level, so a pattern that differs from the previous one
+ * in a few inputs costs only the gates that actually see a change.
+ */
 class Sim {
-  std::unordered_map<core::Node*, FLL_Node_Value> _values;
-  const core::NodeMap& _node_map;
+  const core::FlatNetlist& _netlist;
+  SimulationValues _values;
   core::Node* _fault_node = nullptr;
-  void run_node(core::Node* node);
+  u_int32_t _fault_index;
+  u_int64_t _evaluations = 0;
+  // event-driven mode only: gates to evaluate, and nodes changed since the last `load`. Changes are
+  // only recorded on a simulation that was loaded from a reference, nothing else restores them.
+  std::unique_ptr<core::LevelQueue> _queue;
+  std::vector<u_int32_t> _changed;
+  // every value is up to date with the inputs, so events are enough to follow a change
+  bool _settled = false;
+  // number of `run` calls, tells `load` whether a reference is the one it copied last time
+  u_int64_t _version = 0;
+  const Sim* _loaded_from = nullptr;
+  u_int64_t _loaded_version = 0;
+  void run_node(u_int32_t index);
+  void run_buckets();
+  void set_value(u_int32_t index, FLL_Node_Value value) {
+    if (_values[index] == value) return;
+    _values[index] = value;
+    if (!_queue || !_settled) return;
+    if (_loaded_from) _changed.push_back(index);
+    _queue->push_fanouts(index);
+  }
   
   public:
-  Sim(const core::NodeMap& node_map) : _node_map(node_map) {
-    for (const auto& node : node_map.map) {
-      _values[node.second] = FLL_UNKNOWN;
-    }
-  };
+  Sim(const core::FlatNetlist& netlist, bool event_driven = false)
+    : _netlist(netlist), _values(netlist.size(), FLL_UNKNOWN), _fault_index(netlist.size()),
+      _queue(event_driven ? new core::LevelQueue(netlist) : nullptr) { };
   /**
    * @brief Set the simulation input
    * 
    * @param values vector of input values
    * @throw `std::invalid_argument` if size of `values` does not match the number of inputs
    */
-  void set_input(SimulationValues& values) {
-    if (values.size() != _node_map.inputs.size()) {
+  void set_input(const SimulationValues& values) {
+    if (values.size() != _netlist.inputs.size()) {
       throw std::invalid_argument("Input size mismatch");
     }
-    for (std::size_t i = 0; i < _node_map.inputs.size(); ++i) {
-      // std::cout << "Setting input " << _node_map.inputs[i]->name << " to " << values[i] << std::endl;
-      _values[_node_map.inputs[i]] = values[i];
+    for (std::size_t i = 0; i < _netlist.inputs.size(); ++i) {
+      set_value(_netlist.inputs[i], values[i]);
     }
   }
   /**
@@ -45,9 +73,20 @@ class Sim {
    * @param fault_node pointer to the node with stuck-at fault
    */
   void set_fault(core::Node* fault_node, FLL_Node_Value value) {
+    // a gate that carried the previous fault is evaluated again, an input keeps its value until `set_input`
+    if (_queue && _settled && _fault_index != _netlist.size()) _queue->push(_fault_index);
     _fault_node = fault_node;
-    _values[_fault_node] = value;
+    _fault_index = _netlist.index_of(fault_node);
+    set_value(_fault_index, value);
   }
+  /**
+   * @brief Take over the values of a reference simulation, e.g. the fault-free one, and drop
+   * the fault. In event-driven mode, loading the same `run` of the same reference again only
+   * restores the nodes changed since, so a fault costs no more than the events it causes.
+   *
+   * @param reference simulation of the same netlist, after `run`
+   */
+  void load(const Sim& reference);
   /**
    * @brief Get the fault node
    * 
@@ -56,37 +95,305 @@ class Sim {
   core::Node* get_fault() {
     return _fault_node;
   }
+  /**
+   * @brief Get the simulation value of a node
+   * 
+   * @return `FLL_Node_Value` simulation value of `node`
+   */
+  FLL_Node_Value get_value(const core::Node* node) const {
+    return _values[_netlist.index_of(node)];
+  }
   /**
    * @brief Get simulation values
    * 
-   * @return `std::unordered_map<core::Node*, FLL_Node_Value>&` simulation values
+   * @return `SimulationValues&` simulation values indexed like the compiled netlist
    */
-  std::unordered_map<core::Node*, FLL_Node_Value>& get_values() {
+  SimulationValues& get_values() {
     return _values;
   }
   /**
-   * @brief Run the simulation
+   * @brief Number of gates evaluated since construction
+   */
+  u_int64_t evaluations() const {
+    return _evaluations;
+  }
+  /**
+   * @brief Run the simulation, a single sweep in topological order. In event-driven mode
+   * every later call only evaluates the gates scheduled since, in level order.
    * 
    * @throw `std::runtime_error` if any of the input is not set
    */
   void run();
 };
 
+/**
+ * @brief A stuck-at fault on a node of a compiled netlist
+ */
+struct StuckAtFault {
+  u_int32_t index;
+  FLL_Node_Value value;
+};
+
+/**
+ * @brief Bit-parallel simulator. Every node carries one block of `lanes()` patterns,
+ * so a single sweep over the circuit simulates 64, 256 or 512 patterns depending on
+ * the kernels selected through `simd::select`.
+ */
+class ParallelSim {
+  const core::FlatNetlist& _netlist;
+  const simd::Kernels& _kernels;
+  std::vector<u_int64_t> _values;
+  u_int32_t _fault_index;
+  // values under the fault of the last `run_fault`, equal to the reference outside `_changed`
+  std::vector<u_int64_t> _faulty;
+  std::vector<u_int32_t> _changed;
+  core::LevelQueue _queue;
+  // pattern broadcast by `load_pattern`, `lanes()` when `_values` is the reference
+  std::size_t _pattern;
+  // fault injection of the last `run_faults`, an AND and an OR block per injected node
+  std::vector<u_int32_t> _inject;
+  std::vector<u_int32_t> _injected;
+  std::vector<u_int64_t> _inject_masks;
+  u_int64_t _evaluations = 0;
+  void reference(u_int32_t index, u_int64_t* out) const;
+  bool matches_reference(u_int32_t index) const;
+  void restore();
+
+  public:
+  ParallelSim(const core::FlatNetlist& netlist);
+  /**
+   * @brief Number of 64-bit words in one block
+   */
+  std::size_t words() const {
+    return _kernels.words;
+  }
+  /**
+   * @brief Number of patterns simulated at once
+   */
+  std::size_t lanes() const {
+    return _kernels.words * 64;
+  }
+  /**
+   * @brief Number of gates evaluated since construction, each evaluation covers a whole block
+   */
+  u_int64_t evaluations() const {
+    return _evaluations;
+  }
+  /**
+   * @brief Set the simulation input
+   *
+   * @param words `words()` words per input, bit `i` of the block belongs to pattern `i`
+   * @throw `std::invalid_argument` if size of `words` does not match the number of inputs
+   */
+  void set_input(const std::vector<u_int64_t>& words);
+  /**
+   * @brief Set the fault node, all patterns see the same stuck-at value
+   *
+   * @param fault_node pointer to the node with stuck-at fault
+   */
+  void set_fault(core::Node* fault_node, FLL_Node_Value value);
+  /**
+   * @brief Remove the stuck-at fault set by `set_fault`
+   */
+  void clear_fault() {
+    _fault_index = _netlist.size();
+  }
+  /**
+   * @brief Get the simulation value of a node
+   *
+   * @return `const u_int64_t*` block of `node` holding the values of all patterns
+   */
+  const u_int64_t* get_value(const core::Node* node) const {
+    return get_value(_netlist.index_of(node));
+  }
+  const u_int64_t* get_value(u_int32_t index) const {
+    return &_values[index * _kernels.words];
+  }
+  /**
+   * @brief Get the value of a node under the fault of the last `run_fault`
+   *
+   * @return `const u_int64_t*` block of the node holding the values of all patterns
+   */
+  const u_int64_t* get_faulty_value(u_int32_t index) const {
+    return &_faulty[index * _kernels.words];
+  }
+  /**
+   * @brief Get the values of all nodes
+   *
+   * @return `const std::vector<u_int64_t>&` one block per netlist index
+   */
+  const std::vector<u_int64_t>& get_values() const {
+    return _values;
+  }
+  /**
+   * @brief Replace the values of all nodes, e.g. with the result of an earlier `run`
+   *
+   * @param values one block per netlist index
+   */
+  void set_values(const u_int64_t* values);
+  /**
+   * @brief Run the simulation, a single sweep in topological order
+   */
+  void run();
+  /**
+   * @brief Simulate a stuck-at fault against the values of the last `run` or `set_values`.
+   * Only the fanout cone of the fault site is evaluated, and propagation stops at
+   * every gate whose faulty value matches the fault-free one.
+   *
+   * @param index netlist index of the fault site
+   * @return `const std::vector<u_int32_t>&` nodes whose faulty value differs, valid until the next call
+   */
+  const std::vector<u_int32_t>& run_fault(u_int32_t index, FLL_Node_Value value);
+  /**
+   * @brief Use a single pattern of the last `run` as the reference of `run_faults`.
+   * Its value is broadcast to all lanes, so each lane can carry a different fault.
+   *
+   * @param pattern lane of the pattern in the last `run`
+   */
+  void load_pattern(std::size_t pattern);
+  /**
+   * @brief Simulate up to `lanes()` stuck-at faults at once, lane `k` carries `faults[k]`.
+   * Requires `load_pattern`, propagation is restricted the same way as in `run_fault`.
+   *
+   * @param faults faults to inject
+   * @param count number of faults
+   * @return `const std::vector<u_int32_t>&` nodes whose faulty value differs in any lane, valid until the next call
+   * @throw `std::invalid_argument` if `count` exceeds `lanes()`
+   */
+  const std::vector<u_int32_t>& run_faults(const StuckAtFault* faults, std::size_t count);
+};
+
 // (NoP0, NoO0, NoP1, NoO1)
 typedef std::tuple<unsigned long, unsigned long, unsigned long, unsigned long> FaultImpactValueTuple;
 typedef std::pair<core::Node*, unsigned long> FaultImpactResultValuePair;
+/**
+ * @brief Settings of a fault impact analysis besides rounds and seed
+ */
+struct AnalysisOptions {
+  enum Engine {
+    // FAULT_PARALLEL if the rounds do not fill one block of patterns, PATTERN_PARALLEL otherwise
+    AUTO = 0,
+    // one pattern per simulation using `Sim`
+    SCALAR = 1,
+    // one block of patterns and one fault per simulation using `ParallelSim`
+    PATTERN_PARALLEL = 2,
+    // one pattern and one block of faults per simulation using `ParallelSim`
+    FAULT_PARALLEL = 3,
+  };
+  Engine engine = Engine::AUTO;
+  // Worker threads of the parallel engines, 0 uses every hardware thread
+  std::size_t threads = 0;
+  // Key gates picked from one ranking before the analysis is updated
+  std::size_t batch_size = 1;
+  // Largest share of a candidate's fanout cone that may already be covered by the cones picked in the same batch
+  double max_overlap = 0.5;
+  // Compiled base circuit when a variant of it is analysed, saves compiling it again for every variant
+  std::shared_ptr<const core::FlatNetlist> base_netlist;
+  // Count how often every primary output is corrupted during `run`
+  bool output_histogram = false;
+  // Enumerate every pattern instead of drawing `rounds` random ones if the circuit has at most this many
+  // primary inputs besides key inputs, 0 never does
+  std::size_t exhaustive_threshold = 12;
+  // Enumerate every pattern of these primary inputs whatever their number, the others are drawn at random
+  std::vector<std::string> exhaustive_inputs;
+  // Simulate `adaptive_step` patterns at a time and stop once the best `batch_size` candidates are told apart
+  // from the rest, `rounds` is the most patterns used. Not used when patterns are enumerated.
+  bool adaptive = false;
+  u_int32_t adaptive_step = 128;
+  // Probability that the bounds on every score hold together
+  double confidence = 0.95;
+  // Stop once the best score of the rest is at most this share of the last picked estimate above its bound.
+  // 0 stops only when the upper bound of the rest is below the lower bound of every picked candidate.
+  double tolerance = 0;
+  // Simulate one stuck-at fault of every class of structurally equivalent faults and give its counters to the
+  // whole class. The counters stay exact. Not used while the output histogram is collected.
+  bool collapse_faults = true;
+};
+
+struct AnalysisWorker;
 class FaultImpactAnalysis {
+  public:
+  typedef AnalysisOptions::Engine Engine;
+
+  private:
   std::unordered_map<core::Node*, FaultImpactValueTuple> _fault_impact;
   std::vector<FaultImpactResultValuePair> _res;
   const core::NodeMap& _node_map;
+  AnalysisOptions _options;
+  std::unique_ptr<core::ThreadPool> _pool;
+  // state of the last `run`, kept for `update`
+  u_int32_t _rounds = 0;
+  // patterns `[0, _simulated)` are in the counters, fewer than `_rounds` if the analysis stopped early
+  u_int32_t _simulated = 0;
+  u_int64_t _seed = 0;
+  Engine _engine = Engine::AUTO;
+  std::unique_ptr<core::FlatNetlist> _netlist;
+  // representative of the equivalence class of fault `2 * i + v`, node `i` stuck at `v`, empty if faults are not collapsed
+  std::vector<u_int32_t> _representative;
+  // bit of the Gray code driving every enumerated input, empty if patterns are drawn at random
+  std::unordered_map<const core::Node*, u_int32_t> _gray_bit;
+  // one block per input for every batch, empty while patterns are enumerated
+  std::vector<u_int64_t> _patterns;
+  // fault-free values, one block per node for every batch, empty while patterns are enumerated
+  std::vector<u_int64_t> _good;
+  // corruptions per netlist index while `run` collects the output histogram, empty otherwise
+  std::vector<unsigned long> _output_hits;
+  std::vector<FaultImpactResultValuePair> _output_histogram;
+  std::size_t batches() const;
+  void select_patterns(u_int32_t rounds);
+  bool keeps_batches() const;
+  void fill_patterns(std::size_t batch, u_int64_t* out) const;
+  const u_int64_t* batch_patterns(std::size_t batch, std::vector<u_int64_t>& scratch) const;
+  void load_batch(AnalysisWorker& worker, std::size_t batch) const;
+  void draw_patterns();
+  void simulate_good();
+  void simulate(const std::vector<core::Node*>& sites, u_int32_t first, u_int32_t last);
+  std::vector<core::Node*> all_sites() const;
+  bool adaptive() const;
+  bool settled() const;
+  void advance();
+  void collapse();
+  void run_scalar(const std::vector<StuckAtFault>& faults, u_int32_t first, u_int32_t last, std::vector<unsigned long>& nop,
+                  std::vector<unsigned long>& noo);
+  void run_parallel(const std::vector<StuckAtFault>& faults, u_int32_t first, u_int32_t last, std::vector<unsigned long>& nop,
+                    std::vector<unsigned long>& noo);
+  void run_fault_parallel(const std::vector<StuckAtFault>& faults, u_int32_t first, u_int32_t last, std::vector<unsigned long>& nop,
+                          std::vector<unsigned long>& noo);
+  void merge(const std::vector<std::unique_ptr<AnalysisWorker>>& workers, std::vector<unsigned long>& nop, std::vector<unsigned long>& noo);
+  void rank();
 
   public:
-  FaultImpactAnalysis(const core::NodeMap& node_map) : _node_map(node_map) {
-    for (const auto& node : node_map.map) {
-      _fault_impact[node.second] = std::make_tuple(0, 0, 0, 0);
-    }
-  };
+  FaultImpactAnalysis(const core::NodeMap& node_map, const AnalysisOptions& options = AnalysisOptions());
+  ~FaultImpactAnalysis();
+  /**
+   * @brief Run the analysis. The counters and the ranking only depend on
+   * `rounds` and `seed`, not on the engine width or the number of threads.
+   * Input `i` always sees the same pattern stream, whatever the number of inputs.
+   *
+   * With `exhaustive_inputs`, or with no more than `exhaustive_threshold` inputs, the enumerated
+   * inputs run through all their values in Gray-code order and `rounds` is ignored. Key inputs
+   * are never enumerated, so the patterns stay the same while the circuit is locked.
+   *
+   * With `adaptive`, patterns are simulated `adaptive_step` at a time until the best `batch_size`
+   * candidates are separated from the rest by Bernstein bounds on their NoP and NoO, or `rounds`
+   * patterns are used. The stopping point does not depend on the engine either.
+   *
+   * Faults that are equivalent by structure, e.g. along a chain of BUF and NOT gates or at the controlling
+   * value of a fanin that only drives one gate, are simulated once per class unless `collapse_faults` is off.
+   *
+   * @throw `std::invalid_argument` if an enumerated input is unknown or more than 31 are enumerated
+   */
   void run(u_int32_t rounds, u_int64_t seed);
+  /**
+   * @brief Bring the analysis up to date after the circuit was changed, e.g. by `NodeMap::lock_node`.
+   * Fault-free values are only recomputed in the fanout cone of changed nodes, and only
+   * fault sites whose fanout cone reaches that region are simulated again.
+   * The result matches a fresh `run` with the same rounds and seed. In adaptive mode the update
+   * starts from the patterns used so far and may add more, so it can use more patterns than a fresh `run`.
+   *
+   * @throw `std::logic_error` if `run` has not been called
+   */
+  void update();
   void show() {
     for (const auto& entry: _fault_impact) {
       std::cout << entry.first->name << ": " << std::get<0>(entry.second) << ", " << std::get<1>(entry.second) << ", " << std::get<2>(entry.second) << ", " << std::get<3>(entry.second) << std::endl;
@@ -95,15 +402,39 @@ class FaultImpactAnalysis {
   std::vector<FaultImpactResultValuePair>& get_res() {
     return _res;
   }
+  /**
+   * @brief How often every primary output differed from the fault-free response, summed over
+   * all patterns and stuck-at faults of the last `run`. Only collected if `output_histogram` is set.
+   * An output listed twice counts twice, the same way as in NoO.
+   */
+  const std::vector<FaultImpactResultValuePair>& get_output_histogram() const {
+    return _output_histogram;
+  }
+  void show_output_histogram() const {
+    std::cout << "Output corruptions:" << std::endl;
+    for (const auto& entry: _output_histogram) {
+      std::cout << entry.first->name << ": " << entry.second << std::endl;
+    }
+  }
+  /**
+   * @brief Compiled circuit of the last `run` or `update`
+   */
+  const core::FlatNetlist& get_netlist() const {
+    return *_netlist;
+  }
 };
 
 /**
  * @brief Lock the circuit with `keyBits` bits
+ * `options.batch_size` key gates are taken from every ranking, so the analysis is updated
+ * about `keyBits / options.batch_size` times.
  * 
  * @param map Loaded circuit
  * @param keyBits Number of bits of the key
+ * @throw `std::runtime_error` if the circuit runs out of lockable nodes
  */
-void lock_n_gates(core::NodeMap& map, std::size_t keyBits, u_int32_t rounds, u_int64_t seed);
+void lock_n_gates(core::NodeMap& map, std::size_t keyBits, u_int32_t rounds, u_int64_t seed,
+                  const AnalysisOptions& options = AnalysisOptions());
 
 /**
  * @brief Lock the circuit by percentage
@@ -111,6 +442,7 @@ void lock_n_gates(core::NodeMap& map, std::size_t keyBits, u_int32_t rounds, u_i
  * @param map Loaded circuit
  * @param percentage Percentage of lockable nodes
  */
-void lock_by_percentage(core::NodeMap& map, float percentage, u_int32_t rounds, u_int64_t seed);
+void lock_by_percentage(core::NodeMap& map, float percentage, u_int32_t rounds, u_int64_t seed,
+                        const AnalysisOptions& options = AnalysisOptions());
 
 }
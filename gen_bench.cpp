@@ -0,0 +1,248 @@
+#include "parser.hpp"
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string.h>
+#include <vector>
+
+/**
+ * Synthetic `.bench` generator for benchmarks. Gates are spread evenly over `depth` levels,
+ * the first fanin of a gate comes from the level right below it, so the circuit has exactly
+ * that depth. The other fanins come from any lower level, uniformly or in proportion to the
+ * fanout a node already has, which gives a heavy-tailed fanout distribution.
+ */
+
+struct GeneratorOptions {
+  enum Fanout {
+    UNIFORM = 0,
+    PREFERENTIAL = 1,
+  };
+
+  std::size_t inputs = 32;
+  std::size_t outputs = 32;
+  std::size_t gates = 10000;
+  std::size_t depth = 32;
+  std::size_t max_fanin = 4;
+  Fanout fanout = Fanout::UNIFORM;
+  // weight of every gate type, indexed by `core::GateType`
+  std::vector<double> mix = { 0, 0, 2, 4, 4, 1, 2, 1, 2, 1 };
+  u_int64_t seed = 1;
+  std::string output_file_name = "synthetic.bench";
+};
+
+static void print_help() {
+  std::cout << "Synthetic .bench generator" << std::endl;
+  std::cout << "Usage: " << std::endl;
+  std::cout << "  -i, --inputs <N>                        primary inputs. (default: 32)" << std::endl;
+  std::cout << "  -o, --outputs <N>                       primary outputs. (default: 32)" << std::endl;
+  std::cout << "  -g, --gates <N>                         gates. (default: 10000)" << std::endl;
+  std::cout << "  -d, --depth <N>                         levels of gates, at most the number of gates. (default: 32)" << std::endl;
+  std::cout << "  -m, --max-fanin <N>                     largest fanin of a multi-input gate, at least 2. (default: 4)" << std::endl;
+  std::cout << "  -f, --fanout <uniform | preferential>   how fanins are picked from lower levels. (default: uniform)" << std::endl;
+  std::cout << "                                          preferential picks nodes in proportion to their fanout plus one" << std::endl;
+  std::cout << "  -x, --mix <TYPE=W,...>                  weight of every gate type (default: NOT=2,NAND=4,AND=4,XNOR=1,NOR=2,XOR=1,OR=2,BUF=1)" << std::endl;
+  std::cout << "  -s, --seed <N>                          seed for random number generator. (default: 1)" << std::endl;
+  std::cout << "  -w, --write <filename>                  output file name. (default: synthetic.bench)" << std::endl;
+  std::cout << "  -h, --help                              print help message" << std::endl;
+}
+
+/**
+ * @brief Parse a gate mix like `AND=2,NOT=1`, types which are not listed get weight 0
+ *
+ * @throw `std::invalid_argument` if a type is unknown or no weight is positive
+ */
+static std::vector<double> parse_mix(const std::string& text) {
+  std::vector<double> mix(10, 0);
+  std::size_t begin = 0;
+  while (begin < text.size()) {
+    std::size_t end = text.find(',', begin);
+    if (end == std::string::npos) end = text.size();
+    const std::string entry = text.substr(begin, end - begin);
+    const std::size_t equal = entry.find('=');
+    const std::string name = entry.substr(0, equal);
+    const double weight = equal == std::string::npos ? 1.0 : std::stod(entry.substr(equal + 1));
+    bool found = false;
+#define _(x, y, z, w) \
+    if (name == z && x >= 2) { mix[x] = weight; found = true; }
+    foreach_gate_type
+#undef _
+    if (!found || weight < 0) {
+      throw std::invalid_argument("Invalid gate mix entry " + entry);
+    }
+    begin = end + 1;
+  }
+  double total = 0;
+  for (const auto& weight: mix) total += weight;
+  if (total <= 0) {
+    throw std::invalid_argument("Gate mix has no positive weight");
+  }
+  return mix;
+}
+
+static GeneratorOptions parse_arguments(int argc, char* argv[]) {
+#define option_cmp(argv, option) strncmp(argv, option, sizeof(option)) == 0
+  GeneratorOptions options;
+  for (int i = 1; i < argc; i++) {
+    if (option_cmp(argv[i], "-h") || option_cmp(argv[i], "--help")) {
+      print_help();
+      exit(0);
+    }
+    if (i + 1 >= argc) {
+      std::cerr << "Missing argument: " << argv[i] << std::endl;
+      exit(1);
+    }
+    const char* value = argv[++i];
+    if (option_cmp(argv[i - 1], "-i") || option_cmp(argv[i - 1], "--inputs")) options.inputs = strtoul(value, 0, 10);
+    else if (option_cmp(argv[i - 1], "-o") || option_cmp(argv[i - 1], "--outputs")) options.outputs = strtoul(value, 0, 10);
+    else if (option_cmp(argv[i - 1], "-g") || option_cmp(argv[i - 1], "--gates")) options.gates = strtoul(value, 0, 10);
+    else if (option_cmp(argv[i - 1], "-d") || option_cmp(argv[i - 1], "--depth")) options.depth = strtoul(value, 0, 10);
+    else if (option_cmp(argv[i - 1], "-m") || option_cmp(argv[i - 1], "--max-fanin")) options.max_fanin = strtoul(value, 0, 10);
+    else if (option_cmp(argv[i - 1], "-s") || option_cmp(argv[i - 1], "--seed")) options.seed = strtoull(value, 0, 10);
+    else if (option_cmp(argv[i - 1], "-w") || option_cmp(argv[i - 1], "--write")) options.output_file_name = value;
+    else if (option_cmp(argv[i - 1], "-f") || option_cmp(argv[i - 1], "--fanout")) {
+      if (option_cmp(value, "uniform")) options.fanout = GeneratorOptions::Fanout::UNIFORM;
+      else if (option_cmp(value, "preferential")) options.fanout = GeneratorOptions::Fanout::PREFERENTIAL;
+      else {
+        std::cerr << "Invalid input: " << value << std::endl;
+        exit(1);
+      }
+    }
+    else if (option_cmp(argv[i - 1], "-x") || option_cmp(argv[i - 1], "--mix")) {
+      try {
+        options.mix = parse_mix(value);
+      } catch (std::invalid_argument& e) {
+        std::cerr << e.what() << std::endl;
+        exit(1);
+      }
+    }
+    else {
+      std::cerr << "Unknown input: " << argv[i - 1] << std::endl;
+      print_help();
+      exit(1);
+    }
+  }
+#undef option_cmp
+  if (options.inputs == 0 || options.outputs == 0 || options.gates == 0 || options.depth == 0
+      || options.depth > options.gates || options.max_fanin < 2) {
+    std::cerr << "Invalid sizes, see --help" << std::endl;
+    exit(1);
+  }
+  return options;
+}
+
+int main(int argc, char* argv[]) {
+  const GeneratorOptions options = parse_arguments(argc, argv);
+  std::mt19937_64 random(options.seed);
+  std::discrete_distribution<int> pick_type(options.mix.begin(), options.mix.end());
+  std::uniform_int_distribution<std::size_t> pick_fanin(2, options.max_fanin);
+
+  // node i < inputs is input i, every other node is gate i - inputs
+  const std::size_t n = options.inputs + options.gates;
+  std::vector<core::GateType> types(n, core::GateType::INPUT);
+  std::vector<u_int32_t> fanin_offsets(1, 0);
+  std::vector<u_int32_t> fanins;
+  std::vector<u_int32_t> fanout(n, 0);
+  // every node once plus once per fanout, sampled by the preferential mode
+  std::vector<u_int32_t> attachment;
+  for (u_int32_t i = 0; i < options.inputs; ++i) {
+    fanin_offsets.push_back(0);
+    attachment.push_back(i);
+  }
+  u_int32_t level_begin = 0;
+  u_int32_t level_end = (u_int32_t)options.inputs;
+  u_int32_t next = level_end;
+  for (std::size_t level = 0; level < options.depth; ++level) {
+    const u_int32_t level_size = (u_int32_t)(options.gates / options.depth + (level < options.gates % options.depth ? 1 : 0));
+    const std::size_t attached = attachment.size();
+    for (u_int32_t k = 0; k < level_size; ++k, ++next) {
+      const core::GateType type = (core::GateType)pick_type(random);
+      types[next] = type;
+      const std::size_t count = type == core::GateType::NOT || type == core::GateType::BUF ? 1 : pick_fanin(random);
+      for (std::size_t f = 0; f < count; ++f) {
+        u_int32_t source;
+        if (f == 0) {
+          source = level_begin + (u_int32_t)(random() % (level_end - level_begin));
+        }
+        else if (options.fanout == GeneratorOptions::Fanout::PREFERENTIAL) {
+          // only entries from lower levels, the ones added for this level come after `attached`
+          source = attachment[random() % attached];
+        }
+        else {
+          source = (u_int32_t)(random() % level_end);
+        }
+        fanins.push_back(source);
+        ++fanout[source];
+        if (options.fanout == GeneratorOptions::Fanout::PREFERENTIAL) attachment.push_back(source);
+      }
+      fanin_offsets.push_back((u_int32_t)fanins.size());
+      if (options.fanout == GeneratorOptions::Fanout::PREFERENTIAL) attachment.push_back(next);
+    }
+    level_begin = level_end;
+    level_end = next;
+  }
+
+  // outputs are the gates without fanout, deepest first, then random gates
+  std::vector<u_int32_t> outputs;
+  std::vector<char> is_output(n, 0);
+  for (u_int32_t i = (u_int32_t)n; i-- > options.inputs && outputs.size() < options.outputs;) {
+    if (fanout[i] != 0) continue;
+    outputs.push_back(i);
+    is_output[i] = 1;
+  }
+  const std::size_t n_outputs = std::min(options.outputs, options.gates);
+  while (outputs.size() < n_outputs) {
+    const u_int32_t i = (u_int32_t)(options.inputs + random() % options.gates);
+    if (is_output[i]) continue;
+    outputs.push_back(i);
+    is_output[i] = 1;
+  }
+
+  std::ofstream file(options.output_file_name);
+  if (!file.is_open()) {
+    std::cerr << "Could not open file " << options.output_file_name << std::endl;
+    return 1;
+  }
+  auto name = [&options](u_int32_t i, std::string& out) {
+    out += i < options.inputs ? 'I' : 'G';
+    out += std::to_string(i < options.inputs ? i : i - options.inputs);
+  };
+  std::string out;
+  auto flush = [&file, &out]() {
+    file.write(out.data(), out.size());
+    out.clear();
+  };
+  for (u_int32_t i = 0; i < options.inputs; ++i) {
+    out += "INPUT(";
+    name(i, out);
+    out += ")\n";
+  }
+  for (const auto& i: outputs) {
+    out += "OUTPUT(";
+    name(i, out);
+    out += ")\n";
+  }
+  out += '\n';
+  for (u_int32_t i = (u_int32_t)options.inputs; i < n; ++i) {
+    name(i, out);
+    switch (types[i]) {
+      #define _(x, y, z, w) case core::GateType::y: out += " = " z "("; break;
+      foreach_gate_type_no_in_out
+      #undef _
+      default:
+        break;
+    }
+    for (u_int32_t k = fanin_offsets[i]; k < fanin_offsets[i + 1]; ++k) {
+      if (k != fanin_offsets[i]) out += ", ";
+      name(fanins[k], out);
+    }
+    out += ")\n";
+    if (out.size() >= 1 << 20) flush();
+  }
+  flush();
+  std::cout << "Generated " << options.inputs << " inputs, " << outputs.size() << " outputs and "
+            << options.gates << " gates on " << options.depth << " levels in " << options.output_file_name << std::endl;
+  return 0;
+}
@@ -1,12 +1,261 @@
+#include "bounded_queue.hpp"
 #include "fault.hpp"
+#include "metrics.hpp"
 #include "options.hpp"
 #include "parser.hpp"
 #include "random.hpp"
+#include "simd.hpp"
 #include "visualization.hpp"
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
+/**
+ * @brief File name of one variant, the seed goes before the extension
+ */
+static std::string variant_file_name(const std::string& file_name, u_int64_t seed) {
+  const std::size_t dot = file_name.find_last_of('.');
+  const std::size_t slash = file_name.find_last_of('/');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+    return file_name + "." + std::to_string(seed);
+  }
+  return file_name.substr(0, dot) + "." + std::to_string(seed) + file_name.substr(dot);
+}
+
+/**
+ * @brief Lock a circuit with the selected algorithm
+ */
+static void lock(core::NodeMap& map, const OptionParser& parser, u_int64_t seed, const FLL::AnalysisOptions& options) {
+  if (parser.alg == OptionParser::Algorithm::RLL) {
+
+    if (parser.lock_bits != 0)
+      RLL::lock_n_gates(map, parser.lock_bits, seed);
+    else if(parser.lock_percentage != 0)
+      RLL::lock_by_percentage(map, parser.lock_percentage, seed);
+  }
+  else if (parser.alg == OptionParser::Algorithm::FLL) {
+    if (parser.lock_bits != 0)
+      FLL::lock_n_gates(map, parser.lock_bits, parser.FLL_rounds, seed, options);
+    else if(parser.lock_percentage != 0)
+      FLL::lock_by_percentage(map, parser.lock_percentage, parser.FLL_rounds, seed, options);
+  }
+}
+
+/**
+ * @brief Circuit files of a batch, the `.bench` files and snapshots of a directory in name order,
+ * or the lines of a manifest file. Empty lines and lines starting with `#` are skipped, relative
+ * paths are relative to the manifest.
+ *
+ * @throw `std::runtime_error` if the source cannot be read or two circuits have the same name
+ */
+static std::vector<std::string> list_batch(const std::string& source) {
+  namespace fs = std::filesystem;
+  std::vector<std::string> files;
+  std::error_code error;
+  if (fs::is_directory(source)) {
+    for (const auto& entry: fs::directory_iterator(source, error)) {
+      if (!entry.is_regular_file(error)) continue;
+      const std::string file = entry.path().string();
+      if (entry.path().extension() == ".bench" || core::NodeMap::is_snapshot(file)) files.push_back(file);
+    }
+    std::sort(files.begin(), files.end());
+  }
+  else {
+    std::ifstream manifest(source);
+    if (!manifest.is_open()) {
+      throw std::runtime_error("Could not open batch " + source);
+    }
+    const fs::path base = fs::path(source).parent_path();
+    std::string line;
+    while (std::getline(manifest, line)) {
+      const std::size_t begin = line.find_first_not_of(" \t\r");
+      if (begin == std::string::npos || line[begin] == '#') continue;
+      const fs::path file(line.substr(begin, line.find_last_not_of(" \t\r") + 1 - begin));
+      files.push_back((file.is_absolute() ? file : base / file).string());
+    }
+  }
+  if (error) {
+    throw std::runtime_error("Could not read batch " + source + ": " + error.message());
+  }
+  std::vector<std::string> stems;
+  for (const auto& file: files) stems.push_back(std::filesystem::path(file).stem().string());
+  std::sort(stems.begin(), stems.end());
+  const auto duplicate = std::adjacent_find(stems.begin(), stems.end());
+  if (duplicate != stems.end()) {
+    throw std::runtime_error("Batch has two circuits named " + *duplicate);
+  }
+  return files;
+}
+
+// A circuit on its way through the batch pipeline
+struct BatchJob {
+  std::string input_file_name;
+  std::string output_file_name;
+  std::string visualization_file_name;
+  std::shared_ptr<core::NodeMap> map;
+};
+
+/**
+ * @brief Lock every circuit of `parser.batch_source` in a pipeline of three stages. One thread loads
+ * circuits, the calling thread locks them and one thread writes them, each stage hands its circuits
+ * on through a queue of two. A circuit that fails is reported and skipped.
+ *
+ * @return int exit code, 1 if any circuit failed
+ */
+static int run_batch(const OptionParser& parser, u_int64_t seed, FLL::AnalysisOptions options) {
+  namespace fs = std::filesystem;
+  std::vector<std::string> files;
+  try {
+    files = list_batch(parser.batch_source);
+    fs::create_directories(parser.output_directory);
+  } catch (std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  std::cout << "Batch of " << files.size() << " circuits" << std::endl;
+
+  core::BoundedQueue<BatchJob> loaded(2);
+  core::BoundedQueue<BatchJob> locked(2);
+  std::atomic<bool> failed(false);
+
+  std::thread loader([&]() {
+    for (const auto& file: files) {
+      BatchJob job;
+      job.input_file_name = file;
+      job.map = std::make_shared<core::NodeMap>();
+      try {
+        if (core::NodeMap::is_snapshot(file))
+          job.map->load_snapshot(file);
+        else
+          job.map->load(file);
+      } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        failed = true;
+        continue;
+      }
+      loaded.push(std::move(job));
+    }
+    loaded.close();
+  });
+
+  std::thread writer([&]() {
+    BatchJob job;
+    while (locked.pop(job)) {
+      try {
+        Visualization::write_to_verilog_file(*job.map, job.visualization_file_name, parser.show_intermediate_gates, parser.threads);
+        job.map->save(job.output_file_name, false, parser.threads);
+      } catch (std::exception& e) {
+        std::cerr << job.output_file_name << ": " << e.what() << std::endl;
+        failed = true;
+      }
+      job.map.reset();
+    }
+  });
+
+  BatchJob job;
+  while (loaded.pop(job)) {
+    const fs::path stem = fs::path(parser.output_directory) / fs::path(job.input_file_name).stem();
+    const std::string output_file_name = stem.string() + ".bench";
+    std::error_code error;
+    if (fs::equivalent(job.input_file_name, output_file_name, error)) {
+      std::cerr << "Output " << output_file_name << " would overwrite its input" << std::endl;
+      failed = true;
+      continue;
+    }
+    try {
+      if (parser.variants == 0) {
+        lock(*job.map, parser, seed, options);
+        job.output_file_name = output_file_name;
+        job.visualization_file_name = stem.string() + ".v";
+        locked.push(std::move(job));
+        continue;
+      }
+      std::shared_ptr<const core::NodeMap> base = job.map;
+      options.base_netlist.reset();
+      if (parser.alg == OptionParser::Algorithm::FLL && (parser.lock_bits != 0 || parser.lock_percentage != 0))
+        options.base_netlist = std::make_shared<const core::FlatNetlist>(*base);
+      for (std::size_t i = 0; i < parser.variants; ++i) {
+        BatchJob variant;
+        variant.map = std::make_shared<core::NodeMap>(base);
+        lock(*variant.map, parser, seed + i, options);
+        variant.output_file_name = variant_file_name(output_file_name, seed + i);
+        variant.visualization_file_name = variant_file_name(stem.string() + ".v", seed + i);
+        locked.push(std::move(variant));
+      }
+    } catch (std::exception& e) {
+      std::cerr << job.input_file_name << ": " << e.what() << std::endl;
+      failed = true;
+    }
+  }
+  locked.close();
+  loader.join();
+  writer.join();
+  std::cout << "Batch done" << (failed ? " with errors" : "") << std::endl;
+  return failed ? 1 : 0;
+}
+
+/**
+ * @brief Lock the circuit of `parser.input_file_name`, once or as `parser.variants` variants
+ *
+ * @return int exit code
+ */
+static int run_single(const OptionParser& parser, u_int64_t seed, FLL::AnalysisOptions options) {
+  std::shared_ptr<core::NodeMap> map = std::make_shared<core::NodeMap>();
+  try {
+    if (core::NodeMap::is_snapshot(parser.input_file_name))
+      map->load_snapshot(parser.input_file_name);
+    else
+      map->load(parser.input_file_name);
+    if (!parser.snapshot_file_name.empty())
+      map->save_snapshot(parser.snapshot_file_name);
+  } catch (std::runtime_error& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  if (parser.variants == 0) {
+    // select algorithm
+    try {
+      lock(*map, parser, seed, options);
+
+      Visualization::write_to_verilog_file(*map, parser.visualization_file_name, parser.show_intermediate_gates, parser.threads);
+
+      map->save(parser.output_file_name, false, parser.threads);
+    } catch (std::exception& e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+
+  // every variant shares the loaded circuit, and its compiled form for the fault impact analysis
+  try {
+    if (parser.alg == OptionParser::Algorithm::FLL && (parser.lock_bits != 0 || parser.lock_percentage != 0))
+      options.base_netlist = std::make_shared<const core::FlatNetlist>(*map);
+    for (std::size_t i = 0; i < parser.variants; ++i) {
+      const u_int64_t variant_seed = seed + i;
+      std::cout << "Variant " << i + 1 << " of " << parser.variants << ", seed " << variant_seed << std::endl;
+      core::NodeMap variant(map);
+      lock(variant, parser, variant_seed, options);
+
+      Visualization::write_to_verilog_file(variant, variant_file_name(parser.visualization_file_name, variant_seed),
+                                           parser.show_intermediate_gates, parser.threads);
+
+      variant.save(variant_file_name(parser.output_file_name, variant_seed), false, parser.threads);
+    }
+  } catch (std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
 int main(int argc, char* argv[]) {
 
   // parse command line arguments
@@ -15,30 +264,48 @@ int main(int argc, char* argv[]) {
 
   parser.parse_arguments(argc, argv);
 
-  core::NodeMap map = core::NodeMap();
-  map.load(parser.input_file_name);
+  // pick gate evaluation kernels
+
+  try {
+    simd::select((simd::Width)parser.simd_width);
+  } catch (std::runtime_error& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
 
   // set seed
 
   u_int64_t seed = parser.seed_is_set ? parser.seed : time(nullptr);
 
-  // select algorithm
-  if (parser.alg == OptionParser::Algorithm::RLL) {
+  FLL::AnalysisOptions options;
+  options.engine = (FLL::AnalysisOptions::Engine)parser.engine;
+  options.threads = parser.threads;
+  options.batch_size = parser.batch_size;
+  options.max_overlap = parser.max_overlap;
+  options.output_histogram = parser.output_histogram;
+  options.exhaustive_threshold = parser.exhaustive_threshold;
+  options.exhaustive_inputs = parser.exhaustive_inputs;
+  options.adaptive = parser.adaptive;
+  options.adaptive_step = parser.adaptive_step;
+  options.confidence = parser.confidence;
+  options.tolerance = parser.tolerance;
+  options.collapse_faults = parser.collapse_faults;
 
-    if (parser.lock_bits != 0)
-      RLL::lock_n_gates(map, parser.lock_bits, seed);
-    else if(parser.lock_percentage != 0)
-      RLL::lock_by_percentage(map, parser.lock_percentage, seed);
-  }
-  else if (parser.alg == OptionParser::Algorithm::FLL) {
-    if (parser.lock_bits != 0)
-      FLL::lock_n_gates(map, parser.lock_bits, parser.FLL_rounds, seed);
-    else if(parser.lock_percentage != 0)
-      FLL::lock_by_percentage(map, parser.lock_percentage, parser.FLL_rounds, seed);
-  }
+  core::Metrics& metrics = core::metrics();
+  metrics.set_info("input", parser.batch_source.empty() ? parser.input_file_name : parser.batch_source);
+  metrics.set_info("algorithm", parser.alg == OptionParser::Algorithm::FLL ? "FLL" : "RLL");
+  metrics.set_info("seed", std::to_string(seed));
+  metrics.set_info("simd_lanes", std::to_string(simd::kernels().words * 64));
 
-  Visualization::write_to_verilog_file(map, parser.visualization_file_name, parser.show_intermediate_gates);
+  const int code = parser.batch_source.empty() ? run_single(parser, seed, options) : run_batch(parser, seed, options);
 
-  map.save(parser.output_file_name);
-  return 0;
+  if (!parser.metrics_file_name.empty()) {
+    std::ofstream file(parser.metrics_file_name);
+    if (!file.is_open()) {
+      std::cerr << "Could not open file " << parser.metrics_file_name << std::endl;
+      return 1;
+    }
+    metrics.write_json(file);
+  }
+  return code;
 }
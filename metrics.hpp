@@ -0,0 +1,208 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+namespace core {
+
+/**
+ * @brief Wall time per phase and event counters of a run. Every counter belongs to the phase
+ * it is measured in, which gives its rate. Phases and counters keep the order in which they
+ * first appear. All methods may be called from any thread.
+ */
+class Metrics {
+  struct Phase {
+    std::string name;
+    double seconds;
+    u_int64_t calls;
+  };
+  struct Counter {
+    std::string name;
+    std::string phase;
+    u_int64_t value;
+  };
+  std::vector<Phase> _phases;
+  std::vector<Counter> _counters;
+  std::vector<std::pair<std::string, std::string>> _info;
+  std::chrono::steady_clock::time_point _start = std::chrono::steady_clock::now();
+  mutable std::mutex _mutex;
+
+  static void write_string(std::ostream& out, const std::string& s) {
+    out << '"';
+    for (const auto& c: s) {
+      if (c == '"' || c == '\\') out << '\\';
+      out << c;
+    }
+    out << '"';
+  }
+
+  public:
+  /**
+   * @brief Add the wall time of one call of a phase
+   */
+  void add_time(const std::string& phase, double seconds) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto entry = std::find_if(_phases.begin(), _phases.end(), [&phase](const Phase& p) { return p.name == phase; });
+    if (entry == _phases.end()) entry = _phases.insert(_phases.end(), Phase{ phase, 0, 0 });
+    entry->seconds += seconds;
+    ++entry->calls;
+  }
+  /**
+   * @brief Add to a counter
+   *
+   * @param phase phase whose time the rate of the counter is taken from
+   */
+  void add(const std::string& counter, u_int64_t value, const std::string& phase) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto entry = std::find_if(_counters.begin(), _counters.end(), [&counter](const Counter& c) { return c.name == counter; });
+    if (entry == _counters.end()) entry = _counters.insert(_counters.end(), Counter{ counter, phase, 0 });
+    entry->value += value;
+  }
+  /**
+   * @brief Describe the run, e.g. the input file, the last value of a key wins
+   */
+  void set_info(const std::string& key, const std::string& value) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto entry = std::find_if(_info.begin(), _info.end(), [&key](const std::pair<std::string, std::string>& i) { return i.first == key; });
+    if (entry == _info.end()) _info.emplace_back(key, value);
+    else entry->second = value;
+  }
+  /**
+   * @brief Total wall time of a phase, 0 if it never ran
+   */
+  double seconds(const std::string& phase) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (const auto& p: _phases) {
+      if (p.name == phase) return p.seconds;
+    }
+    return 0;
+  }
+  /**
+   * @brief Peak resident set size of the process in bytes
+   */
+  static std::size_t peak_rss() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return (std::size_t)usage.ru_maxrss * 1024;
+  }
+  /**
+   * @brief Write everything as one JSON object. Phases that overlap, e.g. in batch mode,
+   * are summed separately, so their times can add up to more than the wall time.
+   */
+  void write_json(std::ostream& out) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    char number[64];
+    auto fixed = [&number](double value) {
+      snprintf(number, sizeof(number), "%.6f", value);
+      return number;
+    };
+    out << "{\n  \"info\": {";
+    for (std::size_t i = 0; i < _info.size(); ++i) {
+      out << (i == 0 ? "\n    " : ",\n    ");
+      write_string(out, _info[i].first);
+      out << ": ";
+      write_string(out, _info[i].second);
+    }
+    out << "\n  },\n  \"wall_seconds\": " << fixed(std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count());
+    out << ",\n  \"peak_rss_bytes\": " << peak_rss();
+    out << ",\n  \"phases\": {";
+    for (std::size_t i = 0; i < _phases.size(); ++i) {
+      out << (i == 0 ? "\n    " : ",\n    ");
+      write_string(out, _phases[i].name);
+      out << ": { \"seconds\": " << fixed(_phases[i].seconds) << ", \"calls\": " << _phases[i].calls << " }";
+    }
+    out << "\n  },\n  \"counters\": {";
+    for (std::size_t i = 0; i < _counters.size(); ++i) {
+      const Counter& counter = _counters[i];
+      double seconds = 0;
+      for (const auto& p: _phases) {
+        if (p.name == counter.phase) seconds = p.seconds;
+      }
+      out << (i == 0 ? "\n    " : ",\n    ");
+      write_string(out, counter.name);
+      out << ": { \"value\": " << counter.value << ", \"phase\": ";
+      write_string(out, counter.phase);
+      out << ", \"per_second\": " << fixed(seconds > 0 ? counter.value / seconds : 0) << " }";
+    }
+    out << "\n  }\n}\n";
+  }
+};
+
+/**
+ * @brief Metrics of this process
+ */
+inline Metrics& metrics() {
+  static Metrics instance;
+  return instance;
+}
+
+/**
+ * @brief Add the wall time from construction to destruction to a phase of `metrics()`
+ */
+class PhaseTimer {
+  const char* _phase;
+  std::chrono::steady_clock::time_point _start;
+
+  public:
+  explicit PhaseTimer(const char* phase) : _phase(phase), _start(std::chrono::steady_clock::now()) { }
+  ~PhaseTimer() {
+    metrics().add_time(_phase, std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count());
+  }
+  PhaseTimer(const PhaseTimer&) = delete;
+  PhaseTimer& operator=(const PhaseTimer&) = delete;
+};
+
+/**
+ * @brief Progress line with an estimate of the time left. The line is redrawn at most
+ * every `interval` seconds, so reporting every step costs a clock read and nothing else.
+ */
+class Progress {
+  std::string _label;
+  u_int64_t _total;
+  std::chrono::steady_clock::duration _interval;
+  std::chrono::steady_clock::time_point _start;
+  std::chrono::steady_clock::time_point _last;
+  std::size_t _width = 0;
+
+  public:
+  Progress(const std::string& label, u_int64_t total, double interval = 0.5)
+    : _label(label), _total(total),
+      _interval(std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(interval))),
+      _start(std::chrono::steady_clock::now()), _last(_start) { }
+  /**
+   * @brief Report that `done` of the steps are finished
+   */
+  void update(u_int64_t done) {
+    const auto now = std::chrono::steady_clock::now();
+    if (done < _total && now - _last < _interval) return;
+    _last = now;
+    const double elapsed = std::chrono::duration<double>(now - _start).count();
+    std::string line = _label + ": " + std::to_string(done) + " / " + std::to_string(_total);
+    char eta[64];
+    if (done < _total && done != 0) snprintf(eta, sizeof(eta), ", ETA %.1f s", elapsed * (_total - done) / done);
+    else snprintf(eta, sizeof(eta), ", %.1f s", elapsed);
+    line += eta;
+    // clear what is left of a longer line
+    const std::size_t width = line.size();
+    if (width < _width) line.append(_width - width, ' ');
+    _width = width;
+    std::cout << '\r' << line;
+    std::cout.flush();
+  }
+  /**
+   * @brief Draw the final state and end the line
+   */
+  void finish() {
+    update(_total);
+    std::cout << std::endl;
+  }
+};
+
+}
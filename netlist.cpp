@@ -0,0 +1,133 @@
+#include "netlist.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+namespace core {
+
+FlatNetlist::FlatNetlist(const NodeMap& node_map) {
+  // collect nodes, undeclared fanins are kept as nodes without inputs
+  std::vector<Node*> found;
+  // position in `found` of every node id, `UINT32_MAX` if not found yet
+  std::vector<u_int32_t> id(node_map.size(), UINT32_MAX);
+  auto visit = [&found, &id](Node* node) {
+    if (id[node->id] != UINT32_MAX) return;
+    id[node->id] = (u_int32_t)found.size();
+    found.push_back(node);
+  };
+  for (const auto& input: node_map.inputs) visit(input);
+  for (const auto& gate: node_map.gates) visit(gate);
+  for (std::size_t i = 0; i < found.size(); ++i) {
+    for (const auto& input: node_map.inputs_of(found[i])) visit(node_map.node(input));
+  }
+  const u_int32_t n = (u_int32_t)found.size();
+
+  // levelize with Kahn's algorithm, one frontier per level
+  std::vector<u_int32_t> pending(n);
+  std::vector<std::vector<u_int32_t>> consumers(n);
+  std::vector<u_int32_t> frontier;
+  for (u_int32_t i = 0; i < n; ++i) {
+    pending[i] = node_map.inputs_of(found[i]).size();
+    for (const auto& input: node_map.inputs_of(found[i])) consumers[id[input]].push_back(i);
+    if (pending[i] == 0) frontier.push_back(i);
+  }
+  std::vector<u_int32_t> order;
+  order.reserve(n);
+  this->level_offsets.push_back(0);
+  while (!frontier.empty()) {
+    std::vector<u_int32_t> next;
+    for (const auto& i: frontier) {
+      order.push_back(i);
+      for (const auto& consumer: consumers[i]) {
+        if (--pending[consumer] == 0) next.push_back(consumer);
+      }
+    }
+    this->level_offsets.push_back((u_int32_t)order.size());
+    std::sort(next.begin(), next.end());
+    frontier.swap(next);
+  }
+  if (order.size() != n) {
+    // every node left over has a pending input, walking them must end in a loop
+    u_int32_t i = 0;
+    while (pending[i] == 0) ++i;
+    std::vector<bool> seen(n, false);
+    while (!seen[i]) {
+      seen[i] = true;
+      for (const auto& input: node_map.inputs_of(found[i])) {
+        if (pending[id[input]] != 0) {
+          i = id[input];
+          break;
+        }
+      }
+    }
+    throw std::runtime_error("Combinational loop through node " + std::string(found[i]->name));
+  }
+
+  // renumber in topological order
+  std::vector<u_int32_t> rank(n);
+  this->_index.assign(node_map.size(), UINT32_MAX);
+  for (u_int32_t r = 0; r < n; ++r) rank[order[r]] = r;
+  this->nodes.resize(n);
+  this->types.resize(n);
+  this->levels.resize(n);
+  for (u_int32_t l = 0; l + 1 < this->level_offsets.size(); ++l) {
+    for (u_int32_t r = this->level_offsets[l]; r < this->level_offsets[l + 1]; ++r) {
+      this->levels[r] = l;
+    }
+  }
+  this->fanin_offsets.assign(1, 0);
+  this->fanout_offsets.assign(n + 1, 0);
+  for (u_int32_t r = 0; r < n; ++r) {
+    Node* node = found[order[r]];
+    this->nodes[r] = node;
+    this->types[r] = node->type;
+    this->_index[node->id] = r;
+    for (const auto& input: node_map.inputs_of(node)) {
+      this->fanins.push_back(rank[id[input]]);
+      ++this->fanout_offsets[rank[id[input]] + 1];
+    }
+    this->fanin_offsets.push_back((u_int32_t)this->fanins.size());
+  }
+  for (u_int32_t r = 0; r < n; ++r) this->fanout_offsets[r + 1] += this->fanout_offsets[r];
+  this->fanouts.resize(this->fanins.size());
+  std::vector<u_int32_t> fill(this->fanout_offsets.begin(), this->fanout_offsets.end() - 1);
+  for (u_int32_t r = 0; r < n; ++r) {
+    for (u_int32_t k = this->fanin_offsets[r]; k < this->fanin_offsets[r + 1]; ++k) {
+      this->fanouts[fill[this->fanins[k]]++] = r;
+    }
+  }
+  for (const auto& input: node_map.inputs) this->inputs.push_back(this->_index[input->id]);
+  for (const auto& output: node_map.outputs) this->outputs.push_back(this->_index[output->id]);
+
+  // gates of a level do not depend on each other, so they can run in any order
+  std::vector<u_int32_t> level;
+  for (u_int32_t l = 0; l + 1 < this->level_offsets.size(); ++l) {
+    level.clear();
+    for (u_int32_t r = this->level_offsets[l]; r < this->level_offsets[l + 1]; ++r) {
+      if (this->fanin_count(r) != 0) level.push_back(r);
+    }
+    std::stable_sort(level.begin(), level.end(), [this](u_int32_t a, u_int32_t b) {
+      if (this->types[a] != this->types[b]) return this->types[a] < this->types[b];
+      return this->fanin_count(a) < this->fanin_count(b);
+    });
+    for (std::size_t k = 0; k < level.size(); ++k) {
+      const u_int32_t r = level[k];
+      if (k == 0 || this->types[r] != this->buckets.back().type || this->fanin_count(r) != this->buckets.back().arity) {
+        this->buckets.push_back(Bucket{ this->types[r], this->fanin_count(r), (u_int32_t)this->bucket_gates.size(),
+                                        (u_int32_t)this->bucket_gates.size(), (u_int32_t)this->bucket_fanins.size() });
+      }
+      this->bucket_gates.push_back(r);
+      this->bucket_fanins.insert(this->bucket_fanins.end(), this->fanin_begin(r), this->fanin_begin(r) + this->fanin_count(r));
+      ++this->buckets.back().end;
+    }
+  }
+}
+
+FlatNetlist::FlatNetlist(const FlatNetlist& compiled, const NodeMap& variant) : FlatNetlist(compiled) {
+  if (variant.size() != this->_index.size()) {
+    throw std::invalid_argument("Compiled circuit does not match the variant");
+  }
+  // nodes keep their ids in a variant, only the records differ
+  for (auto&& node: this->nodes) node = variant.node(node->id);
+}
+
+}
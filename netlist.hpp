@@ -0,0 +1,177 @@
+#pragma once
+#include "parser.hpp"
+#include <cstdint>
+#include <stdexcept>
+#include <sys/types.h>
+
+namespace core {
+
+/**
+ * @brief Compiled form of a `NodeMap` used as the simulation substrate.
+ *
+ * Nodes are numbered densely in topological order, grouped by level, so that a
+ * simulation is a single linear sweep over the index range. Fanins and fanouts
+ * are stored in compressed sparse row form: the fanins of node `i` are
+ * `fanins[fanin_offsets[i]]` to `fanins[fanin_offsets[i + 1] - 1]`.
+ */
+class FlatNetlist {
+  // index of every node id, `UINT32_MAX` if the node is not part of the circuit
+  std::vector<u_int32_t> _index;
+
+  public:
+  // Node of every index
+  std::vector<Node*> nodes;
+  // Gate type of every index
+  std::vector<GateType> types;
+  // Level of every index, nodes without fanins are on level 0
+  std::vector<u_int32_t> levels;
+  // Nodes of level `l` are `level_offsets[l]` to `level_offsets[l + 1] - 1`
+  std::vector<u_int32_t> level_offsets;
+  std::vector<u_int32_t> fanin_offsets;
+  std::vector<u_int32_t> fanins;
+  std::vector<u_int32_t> fanout_offsets;
+  std::vector<u_int32_t> fanouts;
+  // Indices of the primary inputs, in the order of `NodeMap::inputs`
+  std::vector<u_int32_t> inputs;
+  // Indices of the primary outputs, in the order of `NodeMap::outputs`
+  std::vector<u_int32_t> outputs;
+
+  /**
+   * @brief Gates of one level with the same type and number of fanins. Gate `k` of the bucket is
+   * `bucket_gates[begin + k]`, its fanins are `bucket_fanins[fanins + k * arity]` onwards.
+   */
+  struct Bucket {
+    GateType type;
+    u_int32_t arity;
+    u_int32_t begin;
+    u_int32_t end;
+    u_int32_t fanins;
+  };
+  // Every gate with fanins, level by level and bucketed within each level, for full sweeps
+  std::vector<Bucket> buckets;
+  std::vector<u_int32_t> bucket_gates;
+  std::vector<u_int32_t> bucket_fanins;
+
+  /**
+   * @brief Compile a loaded circuit
+   *
+   * @param node_map Loaded circuit
+   * @throw `std::runtime_error` if the circuit contains a combinational loop
+   */
+  FlatNetlist(const NodeMap& node_map);
+  /**
+   * @brief Reuse a compiled circuit for a variant of the map it was compiled from,
+   * see `NodeMap(std::shared_ptr<const NodeMap>)`. The variant must not have been changed yet.
+   *
+   * @param compiled Circuit compiled from the base of `variant`
+   * @param variant Variant to point the copy at
+   * @throw `std::invalid_argument` if the variant has a different number of nodes
+   */
+  FlatNetlist(const FlatNetlist& compiled, const NodeMap& variant);
+  /**
+   * @brief Number of nodes
+   */
+  u_int32_t size() const {
+    return (u_int32_t)nodes.size();
+  }
+  /**
+   * @brief Number of levels
+   */
+  u_int32_t depth() const {
+    return (u_int32_t)level_offsets.size() - 1;
+  }
+  /**
+   * @brief Get the index of a node
+   *
+   * @throw `std::out_of_range` if the node is not part of the circuit
+   */
+  u_int32_t index_of(const Node* node) const {
+    if (node->id >= _index.size() || _index[node->id] == UINT32_MAX) {
+      throw std::out_of_range(std::string("Node ") + node->name + " is not part of the circuit");
+    }
+    return _index[node->id];
+  }
+  /**
+   * @brief Look up the index of a node
+   *
+   * @return `false` if the node is not part of the circuit
+   */
+  bool find(const Node* node, u_int32_t& index) const {
+    if (node->id >= _index.size() || _index[node->id] == UINT32_MAX) return false;
+    index = _index[node->id];
+    return true;
+  }
+  u_int32_t fanin_count(u_int32_t index) const {
+    return fanin_offsets[index + 1] - fanin_offsets[index];
+  }
+  const u_int32_t* fanin_begin(u_int32_t index) const {
+    return fanins.data() + fanin_offsets[index];
+  }
+  u_int32_t fanout_count(u_int32_t index) const {
+    return fanout_offsets[index + 1] - fanout_offsets[index];
+  }
+  const u_int32_t* fanout_begin(u_int32_t index) const {
+    return fanouts.data() + fanout_offsets[index];
+  }
+};
+
+/**
+ * @brief Event queue for a compiled netlist. Nodes are popped level by level, so a
+ * node is only evaluated after every queued node it depends on. Every node is
+ * queued at most once until it is popped.
+ */
+class LevelQueue {
+  const FlatNetlist& _netlist;
+  std::vector<std::vector<u_int32_t>> _buckets;
+  std::vector<char> _queued;
+  u_int32_t _level;
+  u_int32_t _last;
+  std::size_t _pos;
+
+  public:
+  LevelQueue(const FlatNetlist& netlist)
+    : _netlist(netlist), _buckets(netlist.depth()), _queued(netlist.size(), 0), _level(1), _last(0), _pos(0) { }
+  bool empty() const {
+    return _level > _last;
+  }
+  void push(u_int32_t index) {
+    if (_queued[index]) return;
+    _queued[index] = 1;
+    const u_int32_t level = _netlist.levels[index];
+    _buckets[level].push_back(index);
+    if (empty()) {
+      _level = level;
+      _last = level;
+      return;
+    }
+    if (level < _level) _level = level;
+    if (level > _last) _last = level;
+  }
+  void push_fanouts(u_int32_t index) {
+    const u_int32_t* fanout = _netlist.fanout_begin(index);
+    for (u_int32_t i = 0; i < _netlist.fanout_count(index); ++i) push(fanout[i]);
+  }
+  /**
+   * @brief Pop the next node in level order
+   *
+   * @return `false` if the queue is empty
+   */
+  bool pop(u_int32_t& index) {
+    while (!empty()) {
+      std::vector<u_int32_t>& bucket = _buckets[_level];
+      if (_pos < bucket.size()) {
+        index = bucket[_pos++];
+        _queued[index] = 0;
+        return true;
+      }
+      bucket.clear();
+      _pos = 0;
+      ++_level;
+    }
+    _level = 1;
+    _last = 0;
+    return false;
+  }
+};
+
+}
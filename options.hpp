@@ -1,6 +1,7 @@
 #include <iostream>
 #include <string.h>
 #include <string>
+#include <vector>
 
 class OptionParser {
 public:
@@ -18,18 +19,43 @@ public:
     FLL = 1,
   };
 
+  enum Engine {
+    AUTO = 0,
+    SCALAR = 1,
+    PATTERN = 2,
+    FAULT = 3,
+  };
+
   Algorithm alg = Algorithm::RLL;
+  Engine engine = Engine::AUTO;
 
   bool show_help = false;
   int lock_bits = 0;
   float lock_percentage = 0.0;
   u_int32_t FLL_rounds = 1000;
+  std::size_t threads = 0;
+  std::size_t batch_size = 1;
+  std::size_t variants = 0;
+  double max_overlap = 0.5;
+  std::size_t exhaustive_threshold = 12;
+  std::vector<std::string> exhaustive_inputs;
+  bool adaptive = false;
+  u_int32_t adaptive_step = 128;
+  double confidence = 0.95;
+  double tolerance = 0;
   u_int64_t seed = 0;
   bool seed_is_set = false;
   bool show_intermediate_gates = false;
+  bool output_histogram = false;
+  bool collapse_faults = true;
+  int simd_width = 0;
   std::string input_file_name = "input.bench";
   std::string output_file_name = "output.bench";
   std::string visualization_file_name = "output.v";
+  std::string snapshot_file_name = "";
+  std::string batch_source = "";
+  std::string output_directory = ".";
+  std::string metrics_file_name = "";
 
   void parse_arguments(int argc, char* argv[]) {
 
@@ -74,6 +100,26 @@ public:
           show_error_and_exit(argc, argv, i, ArgError::INVALID_INPUT);
         }
       }
+      else if (option_cmp(argv[i], "-e") || option_cmp(argv[i], "--engine")) {
+
+        i_plus_1_with_check;
+
+        if (option_cmp(argv[i], "auto")) {
+          engine = Engine::AUTO;
+        }
+        else if (option_cmp(argv[i], "scalar")) {
+          engine = Engine::SCALAR;
+        }
+        else if (option_cmp(argv[i], "pattern")) {
+          engine = Engine::PATTERN;
+        }
+        else if (option_cmp(argv[i], "fault")) {
+          engine = Engine::FAULT;
+        }
+        else {
+          check_invalid_arg_and_exit;
+        }
+      }
       else if (option_cmp(argv[i], "-h") || option_cmp(argv[i], "--help")) {
         show_help = true;
       }
@@ -87,6 +133,19 @@ public:
 
         input_file_name = argv[i];
       }
+      else if (option_cmp(argv[i], "-k") || option_cmp(argv[i], "--batch-size")) {
+
+        i_plus_1_with_check;
+
+        if (argv[i][0] == '-') { // ignore negative number
+          show_error_and_exit(argc, argv, i, ArgError::INVALID_INPUT);
+        }
+        batch_size = strtoul(argv[i], 0, 10);
+
+        if (batch_size == 0) {
+          show_error_and_exit(argc, argv, i, ArgError::INVALID_INPUT);
+        }
+      }
       else if (option_cmp(argv[i], "-o") || option_cmp(argv[i], "--output-file")) {
 
         i_plus_1_with_check;
@@ -143,6 +202,15 @@ public:
           show_error_and_exit(argc, argv, i, ArgError::INVALID_INPUT);
         }
       }
+      else if (option_cmp(argv[i], "-t") || option_cmp(argv[i], "--threads")) {
+
+        i_plus_1_with_check;
+
+        if (argv[i][0] == '-') { // ignore negative number
+          show_error_and_exit(argc, argv, i, ArgError::INVALID_INPUT);
+        }
+        threads = strtoul(argv[i], 0, 10);
+      }
       else if (option_cmp(argv[i], "-v") || option_cmp(argv[i], "--visualization-file")) {
 
         i_plus_1_with_check;
@@ -153,9 +221,154 @@ public:
 
         visualization_file_name = argv[i];
       }
+      else if (option_cmp(argv[i], "--simd")) {
+
+        i_plus_1_with_check;
+
+        if (option_cmp(argv[i], "auto")) {
+          simd_width = 0;
+        }
+        else if (option_cmp(argv[i], "64") || option_cmp(argv[i], "256") || option_cmp(argv[i], "512")) {
+          simd_width = strtol(argv[i], 0, 10);
+        }
+        else {
+          check_invalid_arg_and_exit;
+        }
+      }
+      else if (option_cmp(argv[i], "--max-overlap")) {
+
+        i_plus_1_with_check;
+
+        max_overlap = strtod(argv[i], 0);
+
+        if (max_overlap < 0 || max_overlap > 1) {
+          show_error_and_exit(argc, argv, i, ArgError::INVALID_INPUT);
+        }
+      }
+      else if (option_cmp(argv[i], "--adaptive")) {
+        adaptive = true;
+      }
+      else if (option_cmp(argv[i], "--adaptive-step")) {
+
+        i_plus_1_with_check;
+
+        if (argv[i][0] == '-') { // ignore negative number
+          show_error_and_exit(argc, argv, i, ArgError::INVALID_INPUT);
+        }
+        adaptive_step = strtoul(argv[i], 0, 10);
+
+        if (adaptive_step == 0) {
+          show_error_and_exit(argc, argv, i, ArgError::INVALID_INPUT);
+        }
+      }
+      else if (option_cmp(argv[i], "--confidence")) {
+
+        i_plus_1_with_check;
+
+        confidence = strtod(argv[i], 0);
+
+        if (confidence <= 0 || confidence >= 1) {
+          show_error_and_exit(argc, argv, i, ArgError::INVALID_INPUT);
+        }
+      }
+      else if (option_cmp(argv[i], "--tolerance")) {
+
+        i_plus_1_with_check;
+
+        tolerance = strtod(argv[i], 0);
+
+        if (tolerance < 0) {
+          show_error_and_exit(argc, argv, i, ArgError::INVALID_INPUT);
+        }
+      }
+      else if (option_cmp(argv[i], "--exhaustive-threshold")) {
+
+        i_plus_1_with_check;
+
+        if (argv[i][0] == '-') { // ignore negative number
+          show_error_and_exit(argc, argv, i, ArgError::INVALID_INPUT);
+        }
+        exhaustive_threshold = strtoul(argv[i], 0, 10);
+      }
+      else if (option_cmp(argv[i], "--exhaustive-inputs")) {
+
+        i_plus_1_with_check;
+
+        if (argv[i][0] == '-') {
+          show_error_and_exit(argc, argv, i, ArgError::MISSING_ARG);
+        }
+
+        exhaustive_inputs.clear();
+        std::string names = argv[i];
+        for (std::size_t begin = 0; begin <= names.size();) {
+          std::size_t end = names.find(',', begin);
+          if (end == std::string::npos) end = names.size();
+          if (end != begin) exhaustive_inputs.push_back(names.substr(begin, end - begin));
+          begin = end + 1;
+        }
+      }
+      else if (option_cmp(argv[i], "--batch")) {
+
+        i_plus_1_with_check;
+
+        if (argv[i][0] == '-') {
+          show_error_and_exit(argc, argv, i, ArgError::MISSING_ARG);
+        }
+
+        batch_source = argv[i];
+      }
+      else if (option_cmp(argv[i], "--output-dir")) {
+
+        i_plus_1_with_check;
+
+        if (argv[i][0] == '-') {
+          show_error_and_exit(argc, argv, i, ArgError::MISSING_ARG);
+        }
+
+        output_directory = argv[i];
+      }
+      else if (option_cmp(argv[i], "--variants")) {
+
+        i_plus_1_with_check;
+
+        if (argv[i][0] == '-') { // ignore negative number
+          show_error_and_exit(argc, argv, i, ArgError::INVALID_INPUT);
+        }
+        variants = strtoul(argv[i], 0, 10);
+
+        if (variants == 0) {
+          show_error_and_exit(argc, argv, i, ArgError::INVALID_INPUT);
+        }
+      }
+      else if (option_cmp(argv[i], "--metrics-json")) {
+
+        i_plus_1_with_check;
+
+        if (argv[i][0] == '-') {
+          show_error_and_exit(argc, argv, i, ArgError::MISSING_ARG);
+        }
+
+        metrics_file_name = argv[i];
+      }
+      else if (option_cmp(argv[i], "--snapshot")) {
+
+        i_plus_1_with_check;
+
+        if (argv[i][0] == '-') {
+          show_error_and_exit(argc, argv, i, ArgError::MISSING_ARG);
+        }
+
+        snapshot_file_name = argv[i];
+      }
       else if (option_cmp(argv[i], "--show-intermediate-gates")) {
         show_intermediate_gates = true;
       }
+      else if (option_cmp(argv[i], "--output-histogram")) {
+        output_histogram = true;
+      }
+      else if (option_cmp(argv[i], "--no-fault-collapsing")) {
+        collapse_faults = false;
+      }
       else {
         show_error_and_exit(argc, argv, i, ArgError::UNKNOW_INPUT);
       }
@@ -244,15 +457,48 @@ public:
     std::cout << "Usage: " << std::endl;
     std::cout << "  -a, --algorithm <RLL | FLL>             select Locking algorithm. (default: RLL)" << std::endl;
     std::cout << "  -b, --lock-by-bits <N>                  conflict with -p. number of bits to lock (N > 0)" << std::endl;
+    std::cout << "  -e, --engine <auto | scalar | pattern | fault>" << std::endl;
+    std::cout << "                                          fault simulation engine in FLL algorithm. (default: auto)" << std::endl;
+    std::cout << "                                          pattern packs many patterns per gate evaluation, fault packs many faults" << std::endl;
+    std::cout << "                                          auto picks fault when the rounds do not fill one pattern block" << std::endl;
     std::cout << "  -h, --help                              print help message" << std::endl;
-    std::cout << "  -i, --input-file <filename>             input file name. (default: input.bench)" << std::endl;
+    std::cout << "  -i, --input-file <filename>             input file name, .bench or snapshot. (default: input.bench)" << std::endl;
+    std::cout << "  -k, --batch-size <N>                    key gates picked from one fault impact ranking in FLL algorithm. (default: 1)" << std::endl;
+    std::cout << "                                          larger batches need fewer analysis passes but rank less accurately" << std::endl;
     std::cout << "  -o, --output-file <filename>            output file name. (default: output.bench)" << std::endl;
     std::cout << "  -p, --lock-by-percentage <N>            conflict with -b. percentage to lock (0.0 < N <= 1.0)" << std::endl;
     std::cout << "  -r, --rounds <N>                        test rounds for one lock bit in FLL algorithm. (default 1000)" << std::endl;
     std::cout << "                                          This option only takes effect when algorithm is set to FLL" << std::endl;
+    std::cout << "                                          With --adaptive it is the most rounds" << std::endl;
     std::cout << "  -s, --seed <N>                          seed for random number generator. (default: time(0))" << std::endl;
+    std::cout << "  -t, --threads <N>                       worker threads in FLL algorithm and writers, 0 uses every hardware thread. (default: 0)" << std::endl;
+    std::cout << "                                          The result does not depend on the number of threads" << std::endl;
     std::cout << "  -v, --visualization-file <filename>     output file name for visualization. (default: output.v)" << std::endl;
+    std::cout << "      --adaptive                          simulate rounds in steps in FLL algorithm and stop once the next key gates" << std::endl;
+    std::cout << "                                          are told apart from the other candidates" << std::endl;
+    std::cout << "      --adaptive-step <N>                 rounds simulated between two checks of --adaptive. (default: 128)" << std::endl;
+    std::cout << "      --batch <manifest | directory>      lock every circuit of a directory, or listed one per line in a manifest file" << std::endl;
+    std::cout << "                                          loading, locking and writing of consecutive circuits overlap" << std::endl;
+    std::cout << "                                          -i, -o and -v are ignored, circuit <name>.bench is written to <dir>/<name>.bench and <dir>/<name>.v" << std::endl;
+    std::cout << "      --confidence <N>                    probability that all bounds of --adaptive hold, 0.0 < N < 1.0. (default: 0.95)" << std::endl;
+    std::cout << "      --exhaustive-threshold <N>          enumerate every pattern in FLL algorithm instead of -r random rounds" << std::endl;
+    std::cout << "                                          if the circuit has at most N inputs besides key inputs, 0 never does. (default: 12)" << std::endl;
+    std::cout << "      --exhaustive-inputs <name,...>      enumerate every pattern of these inputs, the other inputs are random" << std::endl;
+    std::cout << "      --max-overlap <N>                   share of a candidate's fanout cone that may overlap the key gates" << std::endl;
+    std::cout << "                                          already picked in its batch, 0.0 <= N <= 1.0. (default: 0.5)" << std::endl;
+    std::cout << "      --metrics-json <filename>           write wall time per phase, counters with their rates and peak memory as JSON" << std::endl;
+    std::cout << "      --snapshot <filename>               save the loaded circuit as a binary snapshot before locking" << std::endl;
+    std::cout << "                                          snapshots are detected automatically when used as input file" << std::endl;
+    std::cout << "      --no-fault-collapsing               simulate every stuck-at fault in FLL algorithm, not one per class of equivalent faults" << std::endl;
+    std::cout << "      --output-histogram                  print how often every output is corrupted in the first fault impact analysis" << std::endl;
+    std::cout << "      --output-dir <dir>                  output directory of batch mode. (default: .)" << std::endl;
     std::cout << "      --show-intermediate-gates           show intermediate gates" << std::endl;
+    std::cout << "      --tolerance <N>                     let --adaptive stop early, while the best other candidate may still beat the next key gates" << std::endl;
+    std::cout << "                                          by at most this share of their score, N >= 0.0. (default: 0, stop once they are separated)" << std::endl;
+    std::cout << "      --variants <N>                      lock N variants of the circuit with the seeds seed, seed + 1, ..." << std::endl;
+    std::cout << "                                          variant files get the seed before the extension, e.g. output.42.bench" << std::endl;
+    std::cout << "      --simd <auto | 64 | 256 | 512>      patterns per gate evaluation in FLL algorithm. (default: auto)" << std::endl;
+    std::cout << "                                          auto picks the widest width supported by the CPU" << std::endl;
     std::cout << std::endl;
     std::cout << "Note:" << std::endl;
     std::cout << "  Neither -b nor -p is set will disable all locking algorithms, and only generate the visualization file." << std::endl;
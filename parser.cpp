@@ -1,39 +1,161 @@
 #include "parser.hpp"
+#include "metrics.hpp"
+#include "rng.hpp"
+#include "writer.hpp"
 #include <iostream>
 #include <fstream>
-#include <sstream>
 #include <algorithm> 
 #include <cctype>
-#include <locale>
+#include <stdexcept>
+#include <string_view>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 // helper functions
-// trim from start (in place)
-inline void ltrim(std::string &s) {
-  s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](unsigned char ch) {
-    return !std::isspace(ch);
-  }));
+// trim whitespace from both ends
+static std::string_view trim(std::string_view s) {
+  std::size_t begin = 0, end = s.size();
+  while (begin < end && std::isspace((unsigned char)s[begin])) ++begin;
+  while (end > begin && std::isspace((unsigned char)s[end - 1])) --end;
+  return s.substr(begin, end - begin);
 }
 
-// trim from end (in place)
-inline void rtrim(std::string &s) {
-  s.erase(std::find_if(s.rbegin(), s.rend(), [](unsigned char ch) {
-    return !std::isspace(ch);
-  }).base(), s.end());
+// read-only mapping of a whole file, unmapped on destruction
+class MappedFile {
+  const char* _data = nullptr;
+  std::size_t _size = 0;
+
+  public:
+  MappedFile() { }
+  ~MappedFile() {
+    if (_data != nullptr) munmap((void*)_data, _size);
+  }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  /**
+   * @brief Map a file
+   *
+   * @return `false` if the file cannot be opened or mapped
+   */
+  bool open(const std::string& filename) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      return false;
+    }
+    _size = (std::size_t)st.st_size;
+    if (_size != 0) {
+      void* data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED) {
+        close(fd);
+        return false;
+      }
+      madvise(data, _size, MADV_SEQUENTIAL);
+      _data = (const char*)data;
+    }
+    close(fd);
+    return true;
+  }
+  std::string_view view() const {
+    return std::string_view(_data, _size);
+  }
+};
+
+namespace core {
+
+NodeMap::NodeMap(std::shared_ptr<const NodeMap> base)
+  : _nodes(base->_nodes), _lock_gates(base->_lock_gates), _base(base), _shared_nodes((NodeId)base->_nodes.size()),
+    _shared_inputs((u_int32_t)base->_input_pool.size()), _shared_outputs((u_int32_t)base->_output_pool.size()) {
+  if (base->_base) {
+    throw std::invalid_argument("A variant cannot be the base of another variant");
+  }
+  // build the shared index now, so looking up names never changes the base
+  if (2 * base->_nodes.size() > base->_index.size()) base->rehash(2 * base->_nodes.size());
+  for (auto list: { std::make_pair(&this->inputs, &base->inputs), std::make_pair(&this->outputs, &base->outputs), std::make_pair(&this->gates, &base->gates) }) {
+    list.first->reserve(list.second->size());
+    for (const auto& node: *list.second) list.first->push_back(this->node(node->id));
+  }
+}
+
+void NodeMap::assign(std::vector<NodeId>& pool, u_int32_t shared, EdgeRange& range, const NodeId* ids, std::size_t count) {
+  if (count > range.count || range.offset < shared) {
+    // the old range is left unused, this only happens while locking
+    range.offset = shared + (u_int32_t)pool.size();
+    pool.insert(pool.end(), ids, ids + count);
+  }
+  else {
+    std::copy(ids, ids + count, pool.begin() + (range.offset - shared));
+  }
+  range.count = (u_int32_t)count;
 }
 
-// trim from both ends (in place)
-inline void trim(std::string &s) {
-    rtrim(s);
-    ltrim(s);
+NodeId* NodeMap::writable_inputs(Node* node) {
+  if (node->inputs.offset < this->_shared_inputs) {
+    // copy on write, the base keeps its range
+    const NodeId* shared = this->_base->_input_pool.data() + node->inputs.offset;
+    node->inputs.offset = this->_shared_inputs + (u_int32_t)this->_input_pool.size();
+    this->_input_pool.insert(this->_input_pool.end(), shared, shared + node->inputs.count);
+  }
+  return this->_input_pool.data() + (node->inputs.offset - this->_shared_inputs);
 }
 
-namespace core {
+std::size_t NodeMap::find_slot(std::string_view name) const {
+  const std::size_t mask = this->_index.size() - 1;
+  for (std::size_t slot = std::hash<std::string_view>()(name) & mask;; slot = (slot + 1) & mask) {
+    const NodeId id = this->_index[slot];
+    if (id == UINT32_MAX) return slot;
+    const char* candidate = this->_nodes[id].name;
+    if (std::strncmp(candidate, name.data(), name.size()) == 0 && candidate[name.size()] == '\0') return slot;
+  }
+}
 
-void NodeMap::lock_node(Node* node, bool key) {
+void NodeMap::rehash(std::size_t n) const {
+  std::size_t size = 16;
+  while (size < n) size *= 2;
+  this->_index.assign(size, UINT32_MAX);
+  for (std::size_t id = this->_shared_nodes; id < this->_nodes.size(); ++id) {
+    this->_index[this->find_slot(this->_nodes[id].name)] = (NodeId)id;
+  }
+}
+
+void NodeMap::build_outputs() {
+  // counting sort of all edges by their input node, consumers keep their order
+  std::vector<u_int32_t> offsets(this->_nodes.size() + 1, 0);
+  for (const auto& node: this->_nodes) {
+    for (const auto& input: this->inputs_of(&node)) ++offsets[input + 1];
+  }
+  for (std::size_t i = 0; i < this->_nodes.size(); ++i) {
+    offsets[i + 1] += offsets[i];
+    this->_nodes[i].outputs.offset = offsets[i];
+    this->_nodes[i].outputs.count = 0;
+  }
+  this->_output_pool.assign(offsets.back(), 0);
+  for (const auto& node: this->_nodes) {
+    for (const auto& input: this->inputs_of(&node)) {
+      EdgeRange& range = this->_nodes[input].outputs;
+      this->_output_pool[range.offset + range.count++] = node.id;
+    }
+  }
+}
+
+std::size_t NodeMap::memory_usage() const {
+  return this->_nodes.size() * sizeof(Node)
+    + this->_names.bytes()
+    + this->_index.capacity() * sizeof(NodeId)
+    + (this->_input_pool.capacity() + this->_output_pool.capacity()) * sizeof(NodeId)
+    + (this->inputs.capacity() + this->outputs.capacity() + this->gates.capacity()) * sizeof(Node*);
+}
+
+Node* NodeMap::insert_lock(Node* node, bool key, u_int64_t seed) {
   if (node->is_lock)
     throw std::runtime_error("Cannot lock a lock node");
   // create key input node
-  Node* keyInput = new Node(std::string("keyinput") + std::to_string(this->_lock_gates.size()), GateType::INPUT);
+  const u_int64_t index = this->_lock_gates;
+  Node* keyInput = this->new_node(std::string("keyinput") + std::to_string(index), GateType::INPUT);
   keyInput->is_output = false;
   keyInput->is_lock = false;
   keyInput->is_key_input = true;
@@ -41,169 +163,481 @@ void NodeMap::lock_node(Node* node, bool key) {
   /**
    * create the lock gate
    * 
-   * first we randomly choose between XOR and XNOR
+   * first we randomly choose between XOR and XNOR, by the bit of this key input
    * if the key is 0 and the lock gate is XNOR, we invert the lock gate
    * if the key is 1 and the lock gate is XOR, we invert the lock gate
    * otherwise, we leave the lock gate as is
    */
-  Node* lock = new Node(node->name + "$enc", std::rand() % 2 == 0 ? GateType::XOR : GateType::XNOR);
+  const bool xnor = Philox(seed, Philox::stream(Philox::LOCK_GATE)).bit(index);
+  Node* lock = this->new_node(std::string(node->name) + "$enc", xnor ? GateType::XNOR : GateType::XOR);
   bool invert = (key == 0 && lock->type == GateType::XNOR) || (key == 1 && lock->type == GateType::XOR);
   lock->is_lock = true;
   this->add_node(lock);
-  if (node->type == GateType::INPUT) {
-    if (invert) {
-      Node* inv = new Node(node->name + "$inv", GateType::NOT);
-      this->add_node(inv);
-      inv->is_lock = true;
-      inv->inputs.push_back(node);
-      lock->inputs.push_back(keyInput);
-      lock->inputs.push_back(inv);
-    }
-    else {
-      lock->inputs.push_back(node);
-      lock->inputs.push_back(keyInput);
+  // move the consumers of the original node over to the lock node, lock gates of earlier keys stay
+  std::vector<NodeId> kept, moved;
+  for (const auto& id: this->outputs_of(node)) {
+    Node* consumer = this->node(id);
+    if (consumer->is_lock) {
+      kept.push_back(id);
+      continue;
     }
+    // a consumer is listed once per edge, so replace one edge at a time
+    NodeId* input = this->writable_inputs(consumer);
+    *std::find(input, input + consumer->inputs.count, node->id) = lock->id;
+    moved.push_back(id);
+  }
+  this->set_outputs(lock, moved.data(), moved.size());
+  if (node->type == GateType::INPUT && invert) {
+    Node* inv = this->new_node(std::string(node->name) + "$inv", GateType::NOT);
+    this->add_node(inv);
+    inv->is_lock = true;
+    const NodeId inv_inputs[] = { node->id };
+    const NodeId lock_inputs[] = { keyInput->id, inv->id };
+    this->set_inputs(inv, inv_inputs, 1);
+    this->set_inputs(lock, lock_inputs, 2);
+    this->set_outputs(inv, &lock->id, 1);
+    kept.push_back(inv->id);
   }
   else {
-    lock->inputs.push_back(node);
-    lock->inputs.push_back(keyInput);
-    if (invert) node->invert();
+    const NodeId lock_inputs[] = { node->id, keyInput->id };
+    this->set_inputs(lock, lock_inputs, 2);
+    kept.push_back(lock->id);
+    if (node->type != GateType::INPUT && invert) node->invert();
   }
+  this->set_outputs(keyInput, &lock->id, 1);
+  this->set_outputs(node, kept.data(), kept.size());
+  node->has_locked = true;
+  return lock;
+}
+
+void NodeMap::lock_node(Node* node, bool key, u_int64_t seed) {
+  Node* lock = this->insert_lock(node, key, seed);
   // if node is an output, replace the original node with the lock node
   if (node->is_output) {
-    std::replace_if(this->outputs.begin(), this->outputs.end(), [&node](Node* n){ return n == node; }, lock);
+    std::replace(this->outputs.begin(), this->outputs.end(), node, lock);
   }
-  // replace the original node with the lock node
-  for (auto&& gate: this->map) {
-    if (gate.second->is_lock) continue;
-    std::replace_if(gate.second->inputs.begin(), gate.second->inputs.end(), [&node](Node* n){ return n == node; }, lock);
+}
+
+void NodeMap::lock_nodes(const std::vector<Node*>& nodes, const std::vector<bool>& key, u_int64_t seed) {
+  if (nodes.size() != key.size()) {
+    throw std::invalid_argument("Number of nodes and key bits mismatch");
   }
-  node->has_locked = true;
+  PhaseTimer timer("lock_insertion");
+  metrics().add("key_bits", key.size(), "lock_insertion");
+  std::unordered_map<Node*, Node*> replaced_outputs;
+  for (std::size_t i = 0; i < nodes.size(); ++i) {
+    Node* lock = this->insert_lock(nodes[i], key[i], seed);
+    if (nodes[i]->is_output) replaced_outputs[nodes[i]] = lock;
+  }
+  // replace locked outputs in one pass
+  if (replaced_outputs.empty()) return;
+  for (auto&& output: this->outputs) {
+    auto entry = replaced_outputs.find(output);
+    if (entry != replaced_outputs.end()) output = entry->second;
+  }
+}
+
+/**
+ * @brief Match a gate function name exactly, `BUFF` is accepted as `BUF`
+ *
+ * @return `false` if the name is unknown
+ */
+static bool parse_gate_type(std::string_view token, GateType& type) {
+  #define _(x, y, z, w) if (token == z || token == w) { type = GateType::y; return true; }
+  foreach_gate_type_no_in_out
+  #undef _
+  if (token == "BUFF" || token == "buff") {
+    type = GateType::BUF;
+    return true;
+  }
+  return false;
 }
 
 void NodeMap::load(const std::string& filename, bool verbose) {
+  PhaseTimer timer("load");
   std::cout << "Loading " << filename << std::endl;
-  std::ifstream file(filename);
-  if (!file.is_open()) {
-    std::cout<< "Could not open file " + filename << std::endl;
-    exit(1);
+  MappedFile file;
+  if (!file.open(filename)) {
+    throw std::runtime_error("Could not open file " + filename);
   }
-  std::string line;
-  while (std::getline(file, line)) {
-    trim(line);
+  const std::string_view text = file.view();
+  // a rough guess of one node per 32 bytes of text
+  this->reserve(this->size() + text.size() / 32);
+  // fanins of the current line
+  std::vector<NodeId> fanins;
+  const NodeId first_loaded = (NodeId)this->size();
+  // referenced before its definition, only registered by name
+  auto is_forward_reference = [](const Node* node) {
+    return node->type == GateType::OUTPUT && !node->is_output;
+  };
+
+  bool misplaced_inputs = false;
+  std::size_t line_number = 0;
+  for (std::size_t pos = 0; pos < text.size();) {
+    std::size_t end = text.find('\n', pos);
+    if (end == std::string_view::npos) end = text.size();
+    std::string_view line = text.substr(pos, end - pos);
+    pos = end + 1;
+    ++line_number;
+    line = trim(line.substr(0, line.find('#')));
     if (line.length() == 0) {
       continue;
     }
     verbose && std::cout << "Parsing: " << line << std::endl;
 
-    if (line.rfind("INPUT", 0) == 0) {
-      verbose && std::cout << "Type: INPUT" << std::endl;
-      Node* node = new Node(line.substr(line.find('(') + 1, line.find(')') - line.find('(') - 1), GateType::INPUT);
-      node->is_output = false;
-      verbose && std::cout << "Name: " << node->name << std::endl;
-      this->add_node(node);
-    }
-    else if (line.rfind("OUTPUT", 0) == 0) {
-      verbose && std::cout << "Type: OUTPUT" << std::endl;
-      Node* node = new Node(line.substr(line.find('(') + 1, line.find(')') - line.find('(') - 1), GateType::OUTPUT);
-      node->is_output = true;
-      verbose && std::cout << "Name: " << node->name << std::endl;
-      this->add_node(node);
-    }
-    else if (line.find('=') != std::string::npos) {
-      bool isNewNode = false;
-      std::string name = line.substr(0, line.find('=') - 1);
-      trim(name);
-      verbose && std::cout << "Name: " << name << std::endl;
+    const std::size_t open = line.find('(');
+    const std::size_t close = line.rfind(')');
+    const std::size_t equal = line.find('=');
+    if (open == std::string_view::npos || close == std::string_view::npos || close < open || (equal != std::string_view::npos && equal > open)) {
+      std::cerr << "Encountered unknown line: " << line << std::endl;
+      continue;
+    }
+    const std::string_view args = line.substr(open + 1, close - open - 1);
+
+    if (equal == std::string_view::npos) {
+      const std::string_view keyword = trim(line.substr(0, open));
+      const std::string_view name = trim(args);
       Node* node = this->get_node(name);
-      if (node != nullptr) {
-        verbose && std::cout << "Found existing node \"" << name << "\"" << std::endl;
-      }
-      else {
-        node = new Node();
-        node->name = name;
-        node->is_output = false;
-        node->is_lock = false;
-        isNewNode = true;
-      }
-      if (0);
-      #define _(x, y, z, w) else if (line.find(z, line.find('=') + 1) != std::string::npos || line.find(w, line.find('=') + 1) != std::string::npos) { \
-        verbose && std::cout << "Type: " << z << std::endl; \
-        node->type = GateType::y; \
+      if (keyword == "INPUT" || keyword == "input") {
+        verbose && std::cout << "Type: INPUT" << std::endl;
+        verbose && std::cout << "Name: " << name << std::endl;
+        if (node == nullptr) {
+          this->add_node(this->new_node(name, GateType::INPUT));
+        }
+        else if (is_forward_reference(node)) {
+          node->type = GateType::INPUT;
+          this->add_node(node);
+        }
+        else if (node->type == GateType::OUTPUT) {
+          // declared as output first, it was taken for a gate
+          node->type = GateType::INPUT;
+          this->inputs.push_back(node);
+          misplaced_inputs = true;
+        }
+        else {
+          std::cerr << "Duplicate declaration of " << name << " at line " << line_number << std::endl;
+        }
       }
-      foreach_gate_type_no_in_out
-      #undef _
-      if (isNewNode) this->add_node(node);
-      std::stringstream ss(line.substr(line.find('(') + 1, line.find(')') - line.find('(') - 1));
-      while (ss.good()) {
-        std::string input;
-        std::getline(ss, input, ',');
-        trim(input);
-        Node* inputNode = this->get_node(input);
-        if (inputNode != nullptr) {
-          verbose && std::cout << "Input: " << input << std::endl;
+      else if (keyword == "OUTPUT" || keyword == "output") {
+        verbose && std::cout << "Type: OUTPUT" << std::endl;
+        verbose && std::cout << "Name: " << name << std::endl;
+        if (node == nullptr) {
+          node = this->new_node(name, GateType::OUTPUT);
+          node->is_output = true;
+          this->add_node(node);
+        }
+        else if (is_forward_reference(node)) {
+          node->is_output = true;
+          this->add_node(node);
         }
         else {
-          inputNode = new Node(input, GateType::OUTPUT); // using OUTPUT as a dummy
-          node->is_output = false;
-          node->is_lock = false;
+          // already an input or a defined gate
+          node->is_output = true;
+          this->outputs.push_back(node);
         }
-        node->inputs.push_back(inputNode);
-        inputNode->outputs.push_back(node);
       }
+      else {
+        std::cerr << "Encountered unknown line: " << line << std::endl;
+      }
+      continue;
+    }
+
+    const std::string_view name = trim(line.substr(0, equal));
+    const std::string_view function = trim(line.substr(equal + 1, open - equal - 1));
+    verbose && std::cout << "Name: " << name << std::endl;
+    GateType type;
+    if (!parse_gate_type(function, type)) {
+      throw std::runtime_error(filename + ":" + std::to_string(line_number) + ": unknown gate type " + std::string(function));
+    }
+    verbose && std::cout << "Type: " << function << std::endl;
+    bool isNewNode = false;
+    Node* node = this->get_node(name);
+    if (node != nullptr) {
+      verbose && std::cout << "Found existing node \"" << name << "\"" << std::endl;
+      // forward references are only registered by name, add them once defined
+      if (is_forward_reference(node)) isNewNode = true;
     }
     else {
-      std::cerr << "Encountered unknown line: " << line << std::endl;
+      node = this->new_node(name, type);
+      isNewNode = true;
+    }
+    node->type = type;
+    if (isNewNode) this->add_node(node);
+    // a repeated definition adds to the inputs
+    const NodeList defined = this->inputs_of(node);
+    fanins.assign(defined.begin(), defined.end());
+    for (std::size_t begin = 0; begin <= args.size();) {
+      std::size_t comma = args.find(',', begin);
+      if (comma == std::string_view::npos) comma = args.size();
+      const std::string_view input = trim(args.substr(begin, comma - begin));
+      begin = comma + 1;
+      if (input.empty()) continue;
+      Node* inputNode = this->get_node(input);
+      if (inputNode != nullptr) {
+        verbose && std::cout << "Input: " << input << std::endl;
+      }
+      else {
+        inputNode = this->new_node(input, GateType::OUTPUT); // using OUTPUT as a dummy
+      }
+      fanins.push_back(inputNode->id);
     }
+    this->set_inputs(node, fanins.data(), fanins.size());
+  }
+  // a used name or a declared output left without a definition would be written back undeclared
+  for (NodeId id = first_loaded; id < this->size(); ++id) {
+    const Node* node = this->node(id);
+    if (is_forward_reference(node) || (node->is_output && node->type == GateType::OUTPUT)) {
+      throw std::runtime_error(filename + ": undefined signal " + node->name);
+    }
+  }
+  this->build_outputs();
+  if (misplaced_inputs) {
+    this->gates.erase(std::remove_if(this->gates.begin(), this->gates.end(), [](const Node* node) {
+      return node->type == GateType::INPUT;
+    }), this->gates.end());
   }
-  file.close();
   std::cout << "Done. Loaded " << this->inputs.size() << " inputs, "
             << this->outputs.size() << " outputs, and "
             << this->gates.size() << " intermediate gates." << std::endl;
+  metrics().add("nodes_loaded", this->size(), "load");
+  std::cout << "Memory: " << this->memory_usage() << " bytes, "
+            << this->memory_usage() / std::max<std::size_t>(1, this->size()) << " bytes per node." << std::endl;
 }
 
-void NodeMap::save(const std::string& filename, bool verbose) {
+void NodeMap::save(const std::string& filename, bool verbose, std::size_t threads) {
+  PhaseTimer timer("save");
   std::cout << "Saving " << filename << std::endl;
   std::ofstream file(filename);
   if (!file.is_open()) {
-    std::cout<< "Could not open file " + filename << std::endl;
-    exit(1);
+    throw std::runtime_error("Could not open file " + filename);
   }
   for (const auto& node: this->inputs) {
     verbose && std::cout << "Writing INPUT(" << node->name << ")" << std::endl;
-    file << "INPUT(" << node->name << ")" << std::endl;
+    file << "INPUT(" << node->name << ")\n";
   }
   for (const auto& node: this->outputs) {
     verbose && std::cout << "Writing OUTPUT(" << node->name << ")" << std::endl;
-    file << "OUTPUT(" << node->name << ")" << std::endl;
-  }
-  file << std::endl;
-  for (const auto& node: this->gates) {
-    std::string logicInputs;
-    for (const auto& input: node->inputs) logicInputs += input->name + ", ";
-    // remove trailing comma
-    logicInputs.pop_back(); logicInputs.pop_back();
-    switch (node->type) {
-      #define _(x, y, z, w) case GateType::y: file << node->name << " = " << z << "(" << logicInputs << ")" << std::endl; break;
-      foreach_gate_type_no_in_out
-      #undef _
-      default:
-        file << node->name << " = UNKNOWN(" << logicInputs << ")" << std::endl;
-        break;
-    }
+    file << "OUTPUT(" << node->name << ")\n";
   }
-  file << std::endl;
+  file << '\n';
+  write_chunked(file, this->gates.size(), threads, [this](std::size_t begin, std::size_t end, std::string& out) {
+    for (std::size_t i = begin; i < end; ++i) {
+      const Node* node = this->gates[i];
+      out += node->name;
+      switch (node->type) {
+        #define _(x, y, z, w) case GateType::y: out += " = " z "("; break;
+        foreach_gate_type_no_in_out
+        #undef _
+        default:
+          out += " = UNKNOWN(";
+          break;
+      }
+      const NodeList inputs = this->inputs_of(node);
+      for (std::size_t k = 0; k < inputs.size(); ++k) {
+        if (k != 0) out += ", ";
+        out += this->node(inputs[k])->name;
+      }
+      out += ")\n";
+    }
+  });
+  file << '\n';
   file.close();
   std::cout << "Done. Saved " << this->inputs.size() << " inputs, "
             << this->outputs.size() << " outputs, and "
             << this->gates.size() << " intermediate gates." << std::endl;
 }
 
+/**
+ * Snapshot layout, every section starts at a multiple of 8 bytes:
+ * header, node records, names, fanin pool, fanout pool, ids of inputs, outputs and gates.
+ * Numbers are stored in host byte order.
+ */
+static const char SNAPSHOT_MAGIC[8] = { 'F', 'L', 'L', 'S', 'N', 'A', 'P', '\0' };
+static const u_int32_t SNAPSHOT_VERSION = 1;
+
+struct SnapshotHeader {
+  char magic[8];
+  u_int32_t version;
+  u_int32_t node_count;
+  u_int64_t name_bytes;
+  u_int64_t input_edges;
+  u_int64_t output_edges;
+  u_int32_t input_count;
+  u_int32_t output_count;
+  u_int32_t gate_count;
+  u_int32_t lock_gates;
+};
+
+struct SnapshotNode {
+  // offset of the name in the name section
+  u_int64_t name;
+  EdgeRange inputs;
+  EdgeRange outputs;
+  u_int8_t type;
+  u_int8_t flags;
+  u_int8_t padding[6];
+};
+
+enum SnapshotFlag : u_int8_t {
+  OUTPUT_FLAG = 1,
+  LOCK_FLAG = 2,
+  KEY_INPUT_FLAG = 4,
+  HAS_LOCKED_FLAG = 8,
+};
+
+static std::size_t align8(std::size_t n) {
+  return (n + 7) & ~(std::size_t)7;
+}
+
+bool NodeMap::is_snapshot(const std::string& filename) {
+  std::ifstream file(filename, std::ios::binary);
+  char magic[sizeof(SNAPSHOT_MAGIC)];
+  return file.read(magic, sizeof(magic)) && std::equal(magic, magic + sizeof(magic), SNAPSHOT_MAGIC);
+}
+
+void NodeMap::load_snapshot(const std::string& filename) {
+  PhaseTimer timer("load");
+  std::cout << "Loading snapshot " << filename << std::endl;
+  if (!this->_nodes.empty()) {
+    throw std::runtime_error("Snapshots can only be loaded into an empty map");
+  }
+  MappedFile file;
+  if (!file.open(filename)) {
+    throw std::runtime_error("Could not open file " + filename);
+  }
+  const std::string_view data = file.view();
+  SnapshotHeader header;
+  if (data.size() < sizeof(header)) {
+    throw std::runtime_error(filename + ": not a snapshot");
+  }
+  std::copy(data.data(), data.data() + sizeof(header), (char*)&header);
+  if (!std::equal(header.magic, header.magic + sizeof(header.magic), SNAPSHOT_MAGIC)) {
+    throw std::runtime_error(filename + ": not a snapshot");
+  }
+  if (header.version != SNAPSHOT_VERSION) {
+    throw std::runtime_error(filename + ": unsupported snapshot version " + std::to_string(header.version));
+  }
+  const std::size_t nodes_at = align8(sizeof(header));
+  const std::size_t names_at = align8(nodes_at + header.node_count * sizeof(SnapshotNode));
+  const std::size_t inputs_at = align8(names_at + header.name_bytes);
+  const std::size_t outputs_at = align8(inputs_at + header.input_edges * sizeof(NodeId));
+  const std::size_t lists_at = align8(outputs_at + header.output_edges * sizeof(NodeId));
+  const std::size_t end = lists_at + ((std::size_t)header.input_count + header.output_count + header.gate_count) * sizeof(NodeId);
+  if (data.size() < end) {
+    throw std::runtime_error(filename + ": truncated snapshot");
+  }
+  auto check = [&](bool valid) {
+    if (!valid) throw std::runtime_error(filename + ": corrupted snapshot");
+  };
+  check(header.name_bytes == 0 || data[names_at + header.name_bytes - 1] == '\0');
+
+  // the arrays are copied as they are, only node names are turned into pointers
+  const char* names = this->_names.add_block(data.data() + names_at, header.name_bytes);
+  for (u_int32_t i = 0; i < header.node_count; ++i) {
+    SnapshotNode record;
+    std::copy(data.data() + nodes_at + i * sizeof(record), data.data() + nodes_at + (i + 1) * sizeof(record), (char*)&record);
+    check(record.name < header.name_bytes && record.type <= GateType::BUF);
+    check((u_int64_t)record.inputs.offset + record.inputs.count <= header.input_edges);
+    check((u_int64_t)record.outputs.offset + record.outputs.count <= header.output_edges);
+    this->_nodes.emplace_back(i, names + record.name, (GateType)record.type);
+    Node& node = this->_nodes.back();
+    node.inputs = record.inputs;
+    node.outputs = record.outputs;
+    node.is_output = record.flags & OUTPUT_FLAG;
+    node.is_lock = record.flags & LOCK_FLAG;
+    node.is_key_input = record.flags & KEY_INPUT_FLAG;
+    node.has_locked = record.flags & HAS_LOCKED_FLAG;
+  }
+  auto read_ids = [&](std::size_t at, std::size_t count, std::vector<NodeId>& ids) {
+    ids.resize(count);
+    std::copy(data.data() + at, data.data() + at + count * sizeof(NodeId), (char*)ids.data());
+    for (const auto& id: ids) check(id < header.node_count);
+  };
+  read_ids(inputs_at, header.input_edges, this->_input_pool);
+  read_ids(outputs_at, header.output_edges, this->_output_pool);
+  std::vector<NodeId> ids;
+  std::size_t at = lists_at;
+  for (auto list: { std::make_pair(&this->inputs, header.input_count), std::make_pair(&this->outputs, header.output_count), std::make_pair(&this->gates, header.gate_count) }) {
+    read_ids(at, list.second, ids);
+    at += list.second * sizeof(NodeId);
+    list.first->reserve(ids.size());
+    for (const auto& id: ids) list.first->push_back(this->node(id));
+  }
+  this->_lock_gates = header.lock_gates;
+  std::cout << "Done. Loaded " << this->inputs.size() << " inputs, "
+            << this->outputs.size() << " outputs, and "
+            << this->gates.size() << " intermediate gates." << std::endl;
+  metrics().add("nodes_loaded", this->size(), "load");
+}
+
+void NodeMap::save_snapshot(const std::string& filename) const {
+  PhaseTimer timer("snapshot");
+  std::cout << "Saving snapshot " << filename << std::endl;
+  std::ofstream file(filename, std::ios::binary);
+  if (!file.is_open()) {
+    throw std::runtime_error("Could not open file " + filename);
+  }
+  SnapshotHeader header = SnapshotHeader();
+  std::copy(SNAPSHOT_MAGIC, SNAPSHOT_MAGIC + sizeof(SNAPSHOT_MAGIC), header.magic);
+  header.version = SNAPSHOT_VERSION;
+  header.node_count = (u_int32_t)this->_nodes.size();
+  header.input_edges = this->_shared_inputs + this->_input_pool.size();
+  header.output_edges = this->_shared_outputs + this->_output_pool.size();
+  header.input_count = (u_int32_t)this->inputs.size();
+  header.output_count = (u_int32_t)this->outputs.size();
+  header.gate_count = (u_int32_t)this->gates.size();
+  header.lock_gates = (u_int32_t)this->_lock_gates;
+  std::vector<SnapshotNode> records(this->_nodes.size(), SnapshotNode());
+  std::string names;
+  for (const auto& node: this->_nodes) {
+    SnapshotNode& record = records[node.id];
+    record.name = names.size();
+    names.append(node.name).push_back('\0');
+    record.inputs = node.inputs;
+    record.outputs = node.outputs;
+    record.type = node.type;
+    record.flags = (node.is_output ? OUTPUT_FLAG : 0) | (node.is_lock ? LOCK_FLAG : 0)
+      | (node.is_key_input ? KEY_INPUT_FLAG : 0) | (node.has_locked ? HAS_LOCKED_FLAG : 0);
+  }
+  header.name_bytes = names.size();
+  const char padding[8] = { 0 };
+  auto write = [&file, &padding](const void* data, std::size_t size) {
+    file.write((const char*)data, size);
+    file.write(padding, align8(size) - size);
+  };
+  // the own edges of a variant follow the shared ones, which keeps its offsets valid
+  auto write_pool = [&file, &padding](const NodeId* shared, std::size_t shared_size, const std::vector<NodeId>& pool) {
+    file.write((const char*)shared, shared_size * sizeof(NodeId));
+    file.write((const char*)pool.data(), pool.size() * sizeof(NodeId));
+    const std::size_t size = (shared_size + pool.size()) * sizeof(NodeId);
+    file.write(padding, align8(size) - size);
+  };
+  auto write_list = [&file](const std::vector<Node*>& list) {
+    std::vector<NodeId> ids(list.size());
+    for (std::size_t i = 0; i < list.size(); ++i) ids[i] = list[i]->id;
+    file.write((const char*)ids.data(), ids.size() * sizeof(NodeId));
+  };
+  write(&header, sizeof(header));
+  write(records.data(), records.size() * sizeof(SnapshotNode));
+  write(names.data(), names.size());
+  write_pool(this->_base ? this->_base->_input_pool.data() : nullptr, this->_shared_inputs, this->_input_pool);
+  write_pool(this->_base ? this->_base->_output_pool.data() : nullptr, this->_shared_outputs, this->_output_pool);
+  write_list(this->inputs);
+  write_list(this->outputs);
+  write_list(this->gates);
+  if (!file) {
+    throw std::runtime_error("Could not write file " + filename);
+  }
+  std::cout << "Done. Saved " << this->inputs.size() << " inputs, "
+            << this->outputs.size() << " outputs, and "
+            << this->gates.size() << " intermediate gates." << std::endl;
+}
+
 void NodeMap::show() {
-  for (const auto& entry: this->map) {
-    std::cout << "Name: " << entry.first << std::endl;
+  for (const auto& node: this->_nodes) {
+    std::cout << "Name: " << node.name << std::endl;
     std::cout << "Type: ";
-    switch (entry.second->type) {
+    switch (node.type) {
       #define _(x, y, z, w) case GateType::y: std::cout << z << std::endl; break;
       foreach_gate_type
       #undef _
@@ -211,22 +645,22 @@ void NodeMap::show() {
         std::cout << "UNKNOWN" << std::endl;
         break;
     }
-    if (entry.second->is_output) {
+    if (node.is_output) {
       std::cout << "Output" << std::endl;
     }
-    if (entry.second->is_lock) {
+    if (node.is_lock) {
       std::cout << "Lock" << std::endl;
     }
-    if (entry.second->type != GateType::INPUT) {
+    if (node.type != GateType::INPUT) {
       std::cout << "Inputs: ";
-      for (const auto& input: entry.second->inputs) {
-        std::cout << input->name << " ";
+      for (const auto& input: this->inputs_of(&node)) {
+        std::cout << this->node(input)->name << " ";
       }
       std::cout << std::endl;
     }
     std::cout << "Outputs: ";
-    for (const auto& output: entry.second->outputs) {
-      std::cout << output->name << " ";
+    for (const auto& output: this->outputs_of(&node)) {
+      std::cout << this->node(output)->name << " ";
     }
     std::cout << std::endl;
   }
@@ -1,5 +1,12 @@
 #pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <sys/types.h>
 #include <vector>
 #include <unordered_map>
 #include <iostream>
@@ -29,17 +36,56 @@
 
 namespace core {
 
-typedef enum _GateType {
+typedef enum _GateType : u_int8_t {
 #define _(x, y, z, w) y = x,
   foreach_gate_type
 #undef _
 } GateType;
 
-// Basic node structure
+// Position of a node in the arena of its `NodeMap`
+typedef u_int32_t NodeId;
+
+// Range of a node's neighbours in one of the edge pools of its `NodeMap`
+struct EdgeRange {
+  u_int32_t offset = 0;
+  u_int32_t count = 0;
+};
+
+// Read-only view of the neighbours of a node
+class NodeList {
+  const NodeId* _data;
+  u_int32_t _size;
+
+  public:
+  NodeList(const NodeId* data, u_int32_t size) : _data(data), _size(size) { }
+  const NodeId* begin() const {
+    return _data;
+  }
+  const NodeId* end() const {
+    return _data + _size;
+  }
+  u_int32_t size() const {
+    return _size;
+  }
+  bool empty() const {
+    return _size == 0;
+  }
+  NodeId operator[](u_int32_t i) const {
+    return _data[i];
+  }
+};
+
+// Basic node structure, owned by a `NodeMap`
 class Node {
   public:
-  // Name of the node
-  std::string name;
+  // Position in the owning `NodeMap`
+  NodeId id;
+  // Input nodes of the node if any, see `NodeMap::inputs_of`
+  EdgeRange inputs;
+  // Output nodes of the node if any, see `NodeMap::outputs_of`
+  EdgeRange outputs;
+  // Name of the node, interned in the owning `NodeMap`
+  const char* name;
   // Type of the node
   GateType type;
   // Is output node
@@ -50,22 +96,9 @@ class Node {
   bool is_key_input;
   // Has been locked by someone else
   bool has_locked;
-  // Input nodes of the node if any
-  std::vector<Node*> inputs;
-  // Output nodes of the node if any
-  std::vector<Node*> outputs;
-
-  Node() { }
 
-  Node(const std::string& name, GateType type) {
-    this->name = name;
-    this->type = type;
-    this->is_output = false;
-    this->is_key_input = false;
-    this->is_lock = false;
-    this->has_locked = false;
-    this->inputs.clear();
-  }
+  Node(NodeId id, const char* name, GateType type)
+    : id(id), name(name), type(type), is_output(false), is_lock(false), is_key_input(false), has_locked(false) { }
 
   void invert() {
     switch (this->type) {
@@ -99,20 +132,157 @@ class Node {
   }
 };
 
+/**
+ * @brief Append-only storage of node names. Strings are copied into large blocks
+ * and never move, so views of them stay valid for the lifetime of the table.
+ */
+class StringTable {
+  static constexpr std::size_t BLOCK_SIZE = 1 << 16;
+  std::vector<std::unique_ptr<char[]>> _blocks;
+  std::size_t _used = BLOCK_SIZE;
+  std::size_t _bytes = 0;
+
+  public:
+  /**
+   * @brief Copy a string into the table
+   *
+   * @return `const char*` null-terminated copy
+   */
+  const char* add(std::string_view s) {
+    const std::size_t size = s.size() + 1;
+    if (_used + size > BLOCK_SIZE) {
+      _blocks.emplace_back(new char[std::max(size, BLOCK_SIZE)]);
+      _bytes += std::max(size, BLOCK_SIZE);
+      _used = 0;
+    }
+    char* copy = _blocks.back().get() + _used;
+    s.copy(copy, s.size());
+    copy[s.size()] = '\0';
+    _used += size;
+    return copy;
+  }
+  /**
+   * @brief Copy a block of null-terminated strings into the table at once
+   *
+   * @return `const char*` start of the copy
+   */
+  const char* add_block(const char* data, std::size_t size) {
+    _blocks.emplace_back(new char[size]);
+    _bytes += size;
+    std::copy(data, data + size, _blocks.back().get());
+    // the block is full, later strings go to a new one
+    _used = BLOCK_SIZE;
+    return _blocks.back().get();
+  }
+  /**
+   * @brief Bytes allocated for blocks
+   */
+  std::size_t bytes() const {
+    return _bytes;
+  }
+};
+
+/**
+ * @brief A loaded circuit. Nodes live in an arena owned by the map and refer to
+ * each other by `NodeId`, their fanin and fanout lists are ranges in two shared pools.
+ *
+ * A variant of a map shares the names, the name index and the edge pools of its base.
+ * It copies the node records, so nodes can be changed without touching the base, and
+ * keeps new nodes and every edge range written after the split in pools of its own.
+ */
 class NodeMap {
-  std::vector<Node*> _lock_gates;
+  std::deque<Node> _nodes;
+  StringTable _names;
+  // open addressing hash table of node ids by name, `UINT32_MAX` marks an empty slot.
+  // It is rebuilt on demand when it holds less than two slots per node.
+  // A variant only indexes the nodes created after the split.
+  mutable std::vector<NodeId> _index;
+  std::vector<NodeId> _input_pool;
+  std::vector<NodeId> _output_pool;
+  std::size_t _lock_gates = 0;
+  // read-only map this one is a variant of, if any
+  std::shared_ptr<const NodeMap> _base;
+  // nodes below this id are indexed by the base
+  NodeId _shared_nodes = 0;
+  // edge offsets below these are ranges in the pools of the base, the others are shifted by them
+  u_int32_t _shared_inputs = 0;
+  u_int32_t _shared_outputs = 0;
+  /**
+   * @brief Point `range` at `ids`, in place if the old range is large enough and not shared
+   */
+  static void assign(std::vector<NodeId>& pool, u_int32_t shared, EdgeRange& range, const NodeId* ids, std::size_t count);
+  /**
+   * @brief Input ids of a node which may be changed in place, copied out of the base first if shared
+   */
+  NodeId* writable_inputs(Node* node);
+  /**
+   * @brief Number of nodes in the index of this map
+   */
+  std::size_t indexed() const {
+    return _nodes.size() - _shared_nodes;
+  }
+  /**
+   * @brief Slot of `name` in the index, or the empty slot where it belongs
+   */
+  std::size_t find_slot(std::string_view name) const;
+  /**
+   * @brief Resize the index to at least `n` slots and insert all nodes again
+   */
+  void rehash(std::size_t n) const;
+  /**
+   * @brief Rebuild every fanout list from the fanin lists
+   */
+  void build_outputs();
+  /**
+   * @brief Insert the lock gate of a node and rewire its consumers, O(fanout of the node).
+   * Primary outputs are left to the caller.
+   *
+   * @param seed picks XOR or XNOR, the choice for the `i`-th key input depends on nothing but `seed` and `i`
+   * @return Node* the lock gate
+   */
+  Node* insert_lock(Node* node, bool key, u_int64_t seed);
   public:
-  std::unordered_map<std::string, Node*> map;
   std::vector<Node*> inputs;
   std::vector<Node*> outputs;
   std::vector<Node*> gates;
 
   NodeMap() { }
-  ~NodeMap() {
-    for (auto it = map.begin(); it!= map.end(); ++it) {
-      delete it->second;
-    }
-    map.clear();
+  /**
+   * @brief Start a variant of a loaded circuit. The base must not change while the variant exists.
+   *
+   * @param base Circuit to share, must not be a variant itself
+   * @throws `std::invalid_argument` if `base` is a variant
+   */
+  explicit NodeMap(std::shared_ptr<const NodeMap> base);
+  NodeMap(const NodeMap&) = delete;
+  NodeMap& operator=(const NodeMap&) = delete;
+  /**
+   * @brief Number of nodes, including undeclared fanins
+   */
+  std::size_t size() const {
+    return _nodes.size();
+  }
+  /**
+   * @brief Get a node by id
+   */
+  Node* node(NodeId id) const {
+    return const_cast<Node*>(&_nodes[id]);
+  }
+  /**
+   * @brief Input nodes of a node
+   */
+  NodeList inputs_of(const Node* node) const {
+    const u_int32_t offset = node->inputs.offset;
+    if (offset < _shared_inputs) return NodeList(_base->_input_pool.data() + offset, node->inputs.count);
+    return NodeList(_input_pool.data() + (offset - _shared_inputs), node->inputs.count);
+  }
+  /**
+   * @brief Output nodes of a node
+   */
+  NodeList outputs_of(const Node* node) const {
+    const u_int32_t offset = node->outputs.offset;
+    if (offset < _shared_outputs) return NodeList(_base->_output_pool.data() + offset, node->outputs.count);
+    return NodeList(_output_pool.data() + (offset - _shared_outputs), node->outputs.count);
   }
   /**
    * @brief Get the Node object
@@ -120,17 +290,43 @@ class NodeMap {
    * @param name Name of the node
    * @return Node* Pointer to the node, or `nullptr` if not found
    */
-  inline Node* get_node(const std::string& name) {
-    if (map.find(name) == map.end()) return nullptr;
-    return map[name];
+  inline Node* get_node(std::string_view name) const {
+    if (_base) {
+      const Node* shared = _base->get_node(name);
+      if (shared != nullptr) return node(shared->id);
+    }
+    if (indexed() == 0) return nullptr;
+    if (2 * indexed() > _index.size()) rehash(2 * indexed());
+    const NodeId id = _index[find_slot(name)];
+    return id == UINT32_MAX ? nullptr : node(id);
   }
   /**
-   * @brief Add a node to the map
+   * @brief Create a node in the arena. It can be found by name, but is not part
+   * of the circuit until it is passed to `add_node`.
    * 
-   * @param node Pointer to `Node` object
+   * @param name Name of the node, must be unique
+   * @param type Type of the node
+   * @return Node* Pointer to the node, valid as long as the map
+   */
+  Node* new_node(std::string_view name, GateType type) {
+    // keep the load factor at most one half
+    if (2 * (indexed() + 1) > _index.size()) rehash(2 * (indexed() + 1));
+    _nodes.emplace_back((NodeId)_nodes.size(), _names.add(name), type);
+    _index[find_slot(name)] = _nodes.back().id;
+    return &_nodes.back();
+  }
+  /**
+   * @brief Prepare the name index for `n` nodes in total
+   */
+  void reserve(std::size_t n) {
+    if (2 * n > _index.size()) rehash(2 * n);
+  }
+  /**
+   * @brief Add a node to the circuit
+   * 
+   * @param node Pointer to a node created by `new_node`
    */
   inline void add_node(Node* node) {
-    map[node->name] = node;
     switch (node->type) {
       case GateType::INPUT:
         inputs.push_back(node);
@@ -141,7 +337,7 @@ class NodeMap {
         break;
       #define _(x, y, z, w) \
       case GateType::y: \
-        if (node->is_lock) _lock_gates.push_back(node); \
+        if (node->is_lock) ++_lock_gates; \
         gates.push_back(node); \
         break;
       foreach_gate_type_no_in_out
@@ -149,19 +345,47 @@ class NodeMap {
       default: break;
     }
   }
+  /**
+   * @brief Set the input nodes of a node. Output lists are not updated.
+   */
+  void set_inputs(Node* node, const NodeId* ids, std::size_t count) {
+    assign(_input_pool, _shared_inputs, node->inputs, ids, count);
+  }
+  /**
+   * @brief Set the output nodes of a node. Input lists are not updated.
+   */
+  void set_outputs(Node* node, const NodeId* ids, std::size_t count) {
+    assign(_output_pool, _shared_outputs, node->outputs, ids, count);
+  }
+  /**
+   * @brief Bytes held by nodes, names, edges and the name index
+   */
+  std::size_t memory_usage() const;
   /**
    * @brief Lock a node. This adds a lock node into the circuit
    * 
    * @param node Node to be locked
    * @param key Key bit
+   * @param seed Seed of the choice between an XOR and an XNOR lock gate
    */
-  void lock_node(Node* node, bool key);
+  void lock_node(Node* node, bool key, u_int64_t seed);
+  /**
+   * @brief Lock several nodes, same as calling `lock_node` for each of them in order.
+   * Primary outputs are updated in a single pass at the end.
+   * 
+   * @param nodes Nodes to be locked
+   * @param key Key bit of every node
+   * @param seed Seed of the choice between an XOR and an XNOR lock gate
+   * @throws `std::invalid_argument` if the sizes differ
+   */
+  void lock_nodes(const std::vector<Node*>& nodes, const std::vector<bool>& key, u_int64_t seed);
   /**
    * @brief Load node data from a file
    * 
    * @param filename file to be loaded
    * @param verbose enable debug output, defaults to `false`
-   * @throws `std::runtime_error` if the file cannot be opened
+   * @throws `std::runtime_error` if the file cannot be opened, a gate has an unknown type,
+   * or a used signal or a declared output is never defined
    */
   void load(const std::string& filename, bool verbose = false);
   /**
@@ -169,8 +393,29 @@ class NodeMap {
    * 
    * @param filename file to be saved
    * @param verbose enable debug output, defaults to `false`
+   * @param threads number of threads formatting the gates, 0 uses every hardware thread
+   * @throws `std::runtime_error` if the file cannot be opened
+   */
+  void save(const std::string& filename, bool verbose = false, std::size_t threads = 0);
+  /**
+   * @brief Check whether a file starts like a snapshot written by `save_snapshot`
+   */
+  static bool is_snapshot(const std::string& filename);
+  /**
+   * @brief Load a binary snapshot into an empty map. The file is mapped and its
+   * arrays are copied as they are, the name index is only built when a name is looked up.
+   * 
+   * @param filename file to be loaded
+   * @throws `std::runtime_error` if the map is not empty or the file is not a valid snapshot
+   */
+  void load_snapshot(const std::string& filename);
+  /**
+   * @brief Save names, types, flags and edges to a binary snapshot
+   * 
+   * @param filename file to be saved
+   * @throws `std::runtime_error` if the file cannot be written
    */
-  void save(const std::string& filename, bool verbose = false);
+  void save_snapshot(const std::string& filename) const;
   /**
    * @brief Show data stored in the map
    * 
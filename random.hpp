@@ -1,4 +1,6 @@
+#include "metrics.hpp"
 #include "parser.hpp"
+#include "rng.hpp"
 #include <algorithm>
 #include <iostream>
 #include <cmath>
@@ -9,22 +11,18 @@ namespace RLL {
 void _lock(core::NodeMap& map, std::vector<core::Node*>& choice, std::size_t keyBits,u_int64_t seed) {
   std::cout << "Locking using Random Logic Locking" << std::endl;
   // prepare key
-  std::srand(seed);
   std::size_t nBits = std::min(keyBits, choice.size());
   if (nBits != keyBits) {
     std::cerr << "Warning keyBits is larger than the number of lockable nodes." << std::endl;
   }
-  std::vector<bool> key(nBits);
-  std::generate(key.begin(), key.end(), []() { return std::rand() % 2; });
+  std::vector<bool> key = core::random_key(nBits, seed);
   std::cout << "Key: ";
   for (const auto& bit : key) {
     std::cout << (bit ? "1" : "0");
   }
   std::cout << std::endl;
   // lock nodes
-  for (std::size_t i = 0; i < key.size(); ++i) {
-    map.lock_node(choice[i], key[i]);
-  }
+  map.lock_nodes(std::vector<core::Node*>(choice.begin(), choice.begin() + key.size()), key, seed);
 }
 
 /**
@@ -36,9 +34,13 @@ void _lock(core::NodeMap& map, std::vector<core::Node*>& choice, std::size_t key
 void lock_n_gates(core::NodeMap& map, std::size_t keyBits,u_int64_t seed) {
   // prepare lockable nodes
   std::vector<core::Node*> choice;
-  choice.insert(choice.end(), map.inputs.begin(), map.inputs.end());
-  choice.insert(choice.end(), map.gates.begin(), map.gates.end());
-  std::random_shuffle(choice.begin(), choice.end());
+  {
+    core::PhaseTimer timer("selection");
+    choice.insert(choice.end(), map.inputs.begin(), map.inputs.end());
+    choice.insert(choice.end(), map.gates.begin(), map.gates.end());
+    core::Philox random(seed, core::Philox::stream(core::Philox::SHUFFLE));
+    core::shuffle(choice, random);
+  }
   RLL::_lock(map, choice, keyBits, seed);
 }
 
@@ -54,9 +56,13 @@ void lock_by_percentage(core::NodeMap& map, float percentage,u_int64_t seed) {
   }
   // prepare lockable nodes
   std::vector<core::Node*> choice;
-  choice.insert(choice.end(), map.inputs.begin(), map.inputs.end());
-  choice.insert(choice.end(), map.gates.begin(), map.gates.end());
-  std::random_shuffle(choice.begin(), choice.end());
+  {
+    core::PhaseTimer timer("selection");
+    choice.insert(choice.end(), map.inputs.begin(), map.inputs.end());
+    choice.insert(choice.end(), map.gates.begin(), map.gates.end());
+    core::Philox random(seed, core::Philox::stream(core::Philox::SHUFFLE));
+    core::shuffle(choice, random);
+  }
   // this conversion is not perfect, but should be good enough
   std::size_t nBits = (std::size_t)std::ceil(choice.size() * percentage);
   RLL::_lock(map, choice, nBits,seed);
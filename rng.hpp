@@ -0,0 +1,115 @@
+#pragma once
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <sys/types.h>
+
+namespace core {
+
+/**
+ * @brief Counter-based generator Philox4x32-10. Word `i` of a stream is a pure function of
+ * the seed, the stream number and `i`, so any thread can draw any part of any stream without
+ * touching shared state, and results do not depend on how the work is split up.
+ */
+class Philox {
+  u_int32_t _key[2];
+  u_int32_t _stream[2];
+  u_int64_t _next = 0;
+
+  static void round(u_int32_t* counter, const u_int32_t* key) {
+    const u_int64_t product0 = (u_int64_t)0xD2511F53 * counter[0];
+    const u_int64_t product1 = (u_int64_t)0xCD9E8D57 * counter[2];
+    const u_int32_t result[4] = {
+      (u_int32_t)(product1 >> 32) ^ counter[1] ^ key[0], (u_int32_t)product1,
+      (u_int32_t)(product0 >> 32) ^ counter[3] ^ key[1], (u_int32_t)product0,
+    };
+    for (int i = 0; i < 4; ++i) counter[i] = result[i];
+  }
+
+  public:
+  /**
+   * @brief What a stream is used for, the high half of a stream number
+   */
+  enum Purpose {
+    KEY = 1,
+    SHUFFLE = 2,
+    LOCK_GATE = 3,
+    PATTERN = 4,
+  };
+  /**
+   * @brief Stream number of the `index`-th stream of a purpose, e.g. the patterns of one input
+   */
+  static u_int64_t stream(Purpose purpose, u_int32_t index = 0) {
+    return ((u_int64_t)purpose << 32) | index;
+  }
+  /**
+   * @brief Encrypt a 128-bit counter under a 64-bit key, ten rounds
+   */
+  static void block(const u_int32_t* key, u_int32_t* counter) {
+    u_int32_t k[2] = { key[0], key[1] };
+    for (int i = 0; i < 10; ++i) {
+      if (i != 0) {
+        k[0] += 0x9E3779B9;
+        k[1] += 0xBB67AE85;
+      }
+      round(counter, k);
+    }
+  }
+
+  Philox(u_int64_t seed, u_int64_t stream)
+    : _key{ (u_int32_t)seed, (u_int32_t)(seed >> 32) }, _stream{ (u_int32_t)stream, (u_int32_t)(stream >> 32) } { }
+  /**
+   * @brief Word `index` of the stream, each block gives two words
+   */
+  u_int64_t at(u_int64_t index) const {
+    const u_int64_t n = index / 2;
+    u_int32_t counter[4] = { (u_int32_t)n, (u_int32_t)(n >> 32), _stream[0], _stream[1] };
+    block(_key, counter);
+    return index % 2 == 0 ? ((u_int64_t)counter[1] << 32) | counter[0] : ((u_int64_t)counter[3] << 32) | counter[2];
+  }
+  /**
+   * @brief Next word of the stream, 64 random bits
+   */
+  u_int64_t operator()() {
+    return this->at(_next++);
+  }
+  /**
+   * @brief Uniform number in `[0, n)`, multiply and shift with rejection of the biased low products
+   */
+  u_int64_t below(u_int64_t n) {
+    const u_int64_t threshold = (0 - n) % n;
+    while (true) {
+      const unsigned __int128 product = (unsigned __int128)(*this)() * n;
+      if ((u_int64_t)product >= threshold) return (u_int64_t)(product >> 64);
+    }
+  }
+  /**
+   * @brief Bit `index` of the stream
+   */
+  bool bit(u_int64_t index) const {
+    return (this->at(index / 64) >> (index % 64)) & 1;
+  }
+};
+
+/**
+ * @brief Fisher-Yates shuffle. Unlike `std::shuffle` the order only depends on the generator,
+ * not on the standard library.
+ */
+template <typename T>
+void shuffle(std::vector<T>& items, Philox& random) {
+  for (std::size_t i = items.size(); i > 1; --i) {
+    std::swap(items[i - 1], items[random.below(i)]);
+  }
+}
+
+/**
+ * @brief Key of `bits` bits, the first bits stay the same for a longer key
+ */
+inline std::vector<bool> random_key(std::size_t bits, u_int64_t seed) {
+  const Philox random(seed, Philox::stream(Philox::KEY));
+  std::vector<bool> key(bits);
+  for (std::size_t i = 0; i < bits; ++i) key[i] = random.bit(i);
+  return key;
+}
+
+}
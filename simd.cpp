@@ -0,0 +1,117 @@
+#include "simd.hpp"
+#include <immintrin.h>
+#include <atomic>
+#include <stdexcept>
+
+using core::GateType;
+
+namespace simd {
+
+/**
+ * Every kernel evaluates one gate on one block, specialized for the gate type and for up
+ * to four inputs, and a bucket kernel runs it over many gates of the same shape. The body is
+ * shared between the widths, only the vector type and its operations differ. Each kernel is
+ * compiled for its own target, so the binary still runs on CPUs without AVX.
+ */
+#define define_eval_kernel(name, target, vec, load, store, and_op, or_op, xor_op, ones) \
+  struct name##_gate { \
+    template <GateType Type, std::size_t Arity> \
+    target static inline void run(const u_int32_t* fanins, std::size_t n, u_int64_t* values, std::size_t out) { \
+      const std::size_t words = sizeof(vec) / sizeof(u_int64_t); \
+      constexpr GateOp op = GateTraits<Type>::op; \
+      const std::size_t count = op == GateOp::COPY ? 1 : Arity == 0 ? n : Arity; \
+      vec acc = load(values + fanins[0] * words); \
+      for (std::size_t i = 1; i < count; ++i) { \
+        const vec next = load(values + fanins[i] * words); \
+        if constexpr (op == GateOp::AND) acc = and_op(acc, next); \
+        else if constexpr (op == GateOp::OR) acc = or_op(acc, next); \
+        else acc = xor_op(acc, next); \
+      } \
+      if constexpr (GateTraits<Type>::invert) acc = xor_op(acc, ones); \
+      store(values + out * words, acc); \
+    } \
+  }; \
+  struct name##_bucket { \
+    template <GateType Type, std::size_t Arity> \
+    target static void run(const u_int32_t* fanins, const u_int32_t* outs, std::size_t count, std::size_t n, u_int64_t* values) { \
+      for (std::size_t k = 0; k < count; ++k) { \
+        name##_gate::run<Type, Arity>(fanins + k * n, n, values, outs[k]); \
+      } \
+    } \
+  }; \
+  target static void name(GateType type, const u_int32_t* fanins, std::size_t n, u_int64_t* values, std::size_t out) { \
+    dispatch<name##_gate>(type, n, fanins, n, values, out); \
+  } \
+  target static void name##_buckets(GateType type, std::size_t arity, const u_int32_t* fanins, const u_int32_t* outs, \
+                                    std::size_t count, u_int64_t* values) { \
+    dispatch<name##_bucket>(type, arity, fanins, outs, count, arity, values); \
+  }
+
+#define scalar_load(p) (*(p))
+#define scalar_store(p, v) (*(p) = (v))
+#define scalar_and(a, b) ((a) & (b))
+#define scalar_or(a, b) ((a) | (b))
+#define scalar_xor(a, b) ((a) ^ (b))
+define_eval_kernel(eval_64, , u_int64_t, scalar_load, scalar_store, scalar_and, scalar_or, scalar_xor, ~0ULL)
+
+#define avx2_load(p) _mm256_loadu_si256((const __m256i*)(p))
+#define avx2_store(p, v) _mm256_storeu_si256((__m256i*)(p), (v))
+define_eval_kernel(eval_256, __attribute__((target("avx2"))), __m256i, avx2_load, avx2_store,
+                   _mm256_and_si256, _mm256_or_si256, _mm256_xor_si256, _mm256_set1_epi64x(-1))
+
+#define avx512_load(p) _mm512_loadu_si512((const void*)(p))
+#define avx512_store(p, v) _mm512_storeu_si512((void*)(p), (v))
+define_eval_kernel(eval_512, __attribute__((target("avx512f"))), __m512i, avx512_load, avx512_store,
+                   _mm512_and_si512, _mm512_or_si512, _mm512_xor_si512, _mm512_set1_epi64(-1))
+
+#undef define_eval_kernel
+
+static const Kernels kernels_64 = { Width::W64, 1, eval_64, eval_64_buckets };
+static const Kernels kernels_256 = { Width::W256, 4, eval_256, eval_256_buckets };
+static const Kernels kernels_512 = { Width::W512, 8, eval_512, eval_512_buckets };
+
+// read by the worker threads of every simulator, so the lazy default must not race with them
+static std::atomic<const Kernels*> selected(nullptr);
+
+Width detect() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return Width::W512;
+  if (__builtin_cpu_supports("avx2")) return Width::W256;
+  return Width::W64;
+}
+
+/**
+ * @brief Kernels of a width, `AUTO` picks the widest supported one
+ */
+static const Kernels* kernels_of(Width width) {
+  Width supported = detect();
+  if (width == Width::AUTO) width = supported;
+  if (width > supported) {
+    throw std::runtime_error(std::to_string(width) + "-bit kernels are not supported by this CPU");
+  }
+  switch (width) {
+    case Width::W512:
+      return &kernels_512;
+    case Width::W256:
+      return &kernels_256;
+    default:
+      return &kernels_64;
+  }
+}
+
+const Kernels& select(Width width) {
+  const Kernels* chosen = kernels_of(width);
+  selected.store(chosen);
+  return *chosen;
+}
+
+const Kernels& kernels() {
+  const Kernels* current = selected.load();
+  if (current != nullptr) return *current;
+  // first use without `select`, keep whatever another thread stored meanwhile
+  const Kernels* detected = kernels_of(Width::AUTO);
+  if (selected.compare_exchange_strong(current, detected)) return *detected;
+  return *current;
+}
+
+}
@@ -0,0 +1,144 @@
+#pragma once
+#include "parser.hpp"
+#include <cstddef>
+#include <sys/types.h>
+
+// Gate evaluation kernels for the bit-parallel simulator
+namespace simd {
+
+typedef enum _Width {
+  AUTO = 0,
+  W64 = 64,
+  W256 = 256,
+  W512 = 512
+} Width;
+
+/**
+ * @brief How a gate type combines its fanins. `COPY` passes the first fanin on.
+ */
+enum class GateOp {
+  COPY,
+  AND,
+  OR,
+  XOR,
+};
+
+/**
+ * @brief Combining operation of a gate type and whether the result is inverted. Types without
+ * a specialization, `INPUT` and `OUTPUT`, copy their first fanin.
+ */
+template <core::GateType Type>
+struct GateTraits {
+  static constexpr GateOp op = GateOp::COPY;
+  static constexpr bool invert = false;
+};
+
+#define define_gate_traits(type, gate_op, gate_invert) \
+  template <> \
+  struct GateTraits<core::GateType::type> { \
+    static constexpr GateOp op = GateOp::gate_op; \
+    static constexpr bool invert = gate_invert; \
+  };
+define_gate_traits(NOT, COPY, true)
+define_gate_traits(BUF, COPY, false)
+define_gate_traits(AND, AND, false)
+define_gate_traits(NAND, AND, true)
+define_gate_traits(OR, OR, false)
+define_gate_traits(NOR, OR, true)
+define_gate_traits(XOR, XOR, false)
+define_gate_traits(XNOR, XOR, true)
+#undef define_gate_traits
+
+/**
+ * @brief Call `Kernel::run<Type, Arity>(args...)` with the number of fanins as a constant,
+ * `Arity` is 0 for the n-ary kernel that takes it at run time
+ */
+template <typename Kernel, core::GateType Type, typename... Args>
+inline void dispatch_arity(std::size_t arity, Args... args) {
+  switch (arity) {
+    case 1:
+      Kernel::template run<Type, 1>(args...);
+      break;
+    case 2:
+      Kernel::template run<Type, 2>(args...);
+      break;
+    case 3:
+      Kernel::template run<Type, 3>(args...);
+      break;
+    case 4:
+      Kernel::template run<Type, 4>(args...);
+      break;
+    default:
+      Kernel::template run<Type, 0>(args...);
+      break;
+  }
+}
+
+/**
+ * @brief Call the specialization of `Kernel::run` for a gate type and number of fanins. Every gate type
+ * of `foreach_gate_type` and arities 1 to 4 get their own instance, larger gates share an n-ary one.
+ */
+template <typename Kernel, typename... Args>
+inline void dispatch(core::GateType type, std::size_t arity, Args... args) {
+  switch (type) {
+#define _(num, name, str, lower) \
+    case core::GateType::name: \
+      dispatch_arity<Kernel, core::GateType::name>(arity, args...); \
+      break;
+    foreach_gate_type
+#undef _
+  }
+}
+
+/**
+ * @brief A set of gate evaluation kernels working on blocks of `words` 64-bit words.
+ * Every node of the circuit owns one block, bit `i` of the block belongs to pattern `i`.
+ */
+struct Kernels {
+  // Width of one block in bits
+  Width width;
+  // Number of 64-bit words in one block
+  std::size_t words;
+  /**
+   * @brief Evaluate one gate
+   *
+   * @param type gate type
+   * @param fanins indices of the input blocks
+   * @param n number of inputs
+   * @param values start of the block array
+   * @param out index of the output block
+   */
+  void (*eval)(core::GateType type, const u_int32_t* fanins, std::size_t n, u_int64_t* values, std::size_t out);
+  /**
+   * @brief Evaluate `count` gates of the same type and number of inputs, see `core::FlatNetlist::Bucket`
+   *
+   * @param type gate type
+   * @param arity number of inputs of every gate
+   * @param fanins indices of the input blocks, `arity` per gate
+   * @param outs index of the output block of every gate
+   * @param count number of gates
+   * @param values start of the block array
+   */
+  void (*eval_bucket)(core::GateType type, std::size_t arity, const u_int32_t* fanins, const u_int32_t* outs, std::size_t count,
+                      u_int64_t* values);
+};
+
+/**
+ * @brief Widest block width supported by the running CPU
+ */
+Width detect();
+
+/**
+ * @brief Select the kernels used by all simulators created afterwards
+ *
+ * @param width requested width, `AUTO` picks the widest supported one
+ * @throw `std::runtime_error` if the running CPU does not support `width`
+ */
+const Kernels& select(Width width);
+
+/**
+ * @brief Currently selected kernels, defaults to `select(AUTO)`. Safe to call from several threads
+ */
+const Kernels& kernels();
+
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace core {
+
+/**
+ * @brief Fixed set of worker threads running indexed tasks.
+ * The calling thread takes part as worker 0, so a pool of size 1 runs everything inline.
+ */
+class ThreadPool {
+  std::vector<std::thread> _workers;
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  std::condition_variable _done;
+  const std::function<void(std::size_t, std::size_t)>* _task = nullptr;
+  std::size_t _n_tasks = 0;
+  std::atomic<std::size_t> _next;
+  std::size_t _busy = 0;
+  std::size_t _generation = 0;
+  bool _stop = false;
+  std::exception_ptr _error;
+
+  void work(std::size_t worker) {
+    for (std::size_t i = _next++; i < _n_tasks; i = _next++) {
+      try {
+        (*_task)(i, worker);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_error) _error = std::current_exception();
+      }
+    }
+  }
+
+  void loop(std::size_t worker) {
+    std::size_t generation = 0;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _wake.wait(lock, [this, generation] { return _stop || _generation != generation; });
+        if (_stop) return;
+        generation = _generation;
+      }
+      work(worker);
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (--_busy == 0) _done.notify_one();
+    }
+  }
+
+  public:
+  /**
+   * @brief Start the workers
+   *
+   * @param n_threads number of threads including the caller, 0 uses every hardware thread
+   */
+  explicit ThreadPool(std::size_t n_threads) : _next(0) {
+    if (n_threads == 0) n_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (std::size_t i = 1; i < n_threads; ++i) {
+      _workers.emplace_back(&ThreadPool::loop, this, i);
+    }
+  }
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+    }
+    _wake.notify_all();
+    for (auto& worker: _workers) worker.join();
+  }
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+  /**
+   * @brief Number of workers including the caller
+   */
+  std::size_t size() const {
+    return _workers.size() + 1;
+  }
+  /**
+   * @brief Run `task(i, worker)` for every `i` in `[0, n_tasks)` and wait for all of them.
+   * Tasks are handed out in increasing order, `worker` is in `[0, size())`.
+   *
+   * @throw the first exception thrown by a task
+   */
+  void run(std::size_t n_tasks, const std::function<void(std::size_t, std::size_t)>& task) {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _task = &task;
+      _n_tasks = n_tasks;
+      _next = 0;
+      _busy = _workers.size();
+      _error = nullptr;
+      ++_generation;
+    }
+    _wake.notify_all();
+    work(0);
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done.wait(lock, [this] { return _busy == 0; });
+    if (_error) std::rethrow_exception(_error);
+  }
+};
+
+}
@@ -1,88 +1,170 @@
+#include "metrics.hpp"
+#include "netlist.hpp"
 #include "parser.hpp"
+#include "writer.hpp"
 
 #include <fstream>
 #include <map>
+#include <stdexcept>
 #include <string>
 
 namespace Visualization {
 
-std::string get_node_expression(std::unordered_map<const core::Node*, std::string>& dp, const core::Node* node) {
-
-  // if node is already visited, return th expression
-  if (dp.find(node) != dp.end()) {
-    return dp[node];
-  }
-
-  // gate is input, return itself
-  if (node->type == core::GateType::INPUT) {
-    // std::cout << node->name << ": " << node->name << std::endl;
-    dp[node] = std::string(node->name);
-    return std::string(node->name);
+/**
+ * @brief Append the operand at index `input` of an expression, by name if it is a signal of its own
+ */
+void append_operand(const core::FlatNetlist& netlist, const std::vector<char>& named, std::vector<std::string>& expressions,
+                    u_int32_t input, std::string& out) {
+  if (named[input]) {
+    out += netlist.nodes[input]->name;
+    return;
   }
+  // an inlined node has exactly one consumer, so its expression is used up here
+  out += expressions[input];
+  std::string().swap(expressions[input]);
+}
 
-  // return !(gate)
-  if (node->type == core::GateType::NOT) {
-    // std::cout << node->inputs[0]->name << ": " << std::string("!(" + node->inputs[0]->name + ")") << std::endl;
-    dp[node] = std::string("!(" + get_node_expression(dp, node->inputs[0]) + ")");
-    return std::string("!(" + get_node_expression(dp, node->inputs[0]) + ")");
+/**
+ * @brief Write one `assign` per output and per node with more than one consumer.
+ * Every other gate is inlined into the expression of its only consumer, so the file
+ * grows linearly with the circuit. Nodes are visited in topological order without recursion.
+ *
+ * @throw `std::runtime_error` if the circuit contains a combinational loop
+ */
+void write_assignments(const core::NodeMap& node_map, std::ofstream& file) {
+  const core::FlatNetlist netlist(node_map);
+  const u_int32_t n = netlist.size();
+
+  // `Node::is_output` stays on a locked output, the list of outputs is authoritative
+  std::vector<char> output(n, 0);
+  for (const auto& i: netlist.outputs) output[i] = 1;
+
+  // nodes which do not reach an output are left out
+  std::vector<char> live(n, 0);
+  for (u_int32_t i = n; i-- > 0;) {
+    live[i] = output[i];
+    for (u_int32_t k = 0; !live[i] && k < netlist.fanout_count(i); ++k) {
+      live[i] = live[netlist.fanout_begin(i)[k]];
+    }
   }
 
-  // return (gate)
-  if (node->type == core::GateType::BUF) {
-    // std::cout << node->inputs[0]->name << ": " << std::string("!(" + node->inputs[0]->name + ")") << std::endl;
-    dp[node] = std::string(get_node_expression(dp, node->inputs[0]));
-    return std::string(get_node_expression(dp, node->inputs[0]));
+  // inputs, outputs and shared nodes are referenced by name, undriven nodes become wires without assignment
+  std::vector<char> named(n, 0);
+  std::string out;
+  for (u_int32_t i = 0; i < n; ++i) {
+    const core::Node* node = netlist.nodes[i];
+    named[i] = output[i] || netlist.fanin_count(i) == 0 || netlist.fanout_count(i) > 1;
+    if (!live[i] || !named[i] || output[i] || node->type == core::GateType::INPUT) continue;
+    out += out.empty() ? "wire " : ",";
+    out += node->name;
   }
-
-  std::string output = "";
-  std::string prefix = "(";
-
-  // if gate is a N__ gate, use prefix "!(" gate)
-  if (node->type == core::GateType::NOR || node->type == core::GateType::NAND || node->type == core::GateType::XNOR) {
-    prefix = "!(";
+  if (!out.empty()) {
+    out += ";\n\n";
+    file.write(out.data(), out.size());
+    out.clear();
   }
 
-  // [input0]
-  output = get_node_expression(dp, node->inputs[0]);
-
-  for (std::size_t i = 1; i < node->inputs.size(); ++i) {
-
-    // !([input0]
-    output = prefix + output;
-
-    // add operator
-    if (node->type == core::GateType::NOR || node->type == core::GateType::OR) {
-      output += " | ";
+  std::vector<std::string> expressions(n);
+  for (u_int32_t i = 0; i < n; ++i) {
+    if (!live[i] || netlist.fanin_count(i) == 0) continue;
+    const core::Node* node = netlist.nodes[i];
+    const u_int32_t* inputs = netlist.fanin_begin(i);
+    std::string& expression = named[i] ? out : expressions[i];
+    if (named[i]) {
+      out += "assign ";
+      out += node->name;
+      out += " = ";
     }
-    else if (node->type == core::GateType::NAND || node->type == core::GateType::AND) {
-      output += " & ";
+
+    const char* op = nullptr;
+    switch (node->type) {
+      case core::GateType::OR:
+      case core::GateType::NOR:
+        op = " | ";
+        break;
+      case core::GateType::AND:
+      case core::GateType::NAND:
+        op = " & ";
+        break;
+      case core::GateType::XOR:
+      case core::GateType::XNOR:
+        op = " ^ ";
+        break;
+      case core::GateType::NOT:
+      case core::GateType::BUF:
+        break;
+      default:
+        // node should only be this eight gate types.
+        std::cout << "Something went wrong" << std::endl;
+        break;
     }
-    else if (node->type == core::GateType::XOR || node->type == core::GateType::XNOR) {
-      output += " ^ ";
+
+    if (op == nullptr) {
+      // return !(gate) or (gate)
+      if (node->type == core::GateType::NOT) expression += "!(";
+      append_operand(netlist, named, expressions, inputs[0], expression);
+      if (node->type == core::GateType::NOT) expression += ')';
     }
     else {
-      // node should only be this six gate types.
-      std::cout << "Something went wrong" << std::endl;
+      // if gate is a N__ gate, use prefix "!(" gate)
+      const bool inverted = node->type == core::GateType::NOR || node->type == core::GateType::NAND || node->type == core::GateType::XNOR;
+      expression += inverted ? "!(" : "(";
+      for (u_int32_t k = 0; k < netlist.fanin_count(i); ++k) {
+        if (k != 0) expression += op;
+        append_operand(netlist, named, expressions, inputs[k], expression);
+      }
+      expression += ')';
     }
 
-    // !([input0] [operator] [input1])
-    output += get_node_expression(dp, node->inputs[i]) + ")";
+    if (named[i]) {
+      out += ";\n";
+      if (out.size() >= 1 << 20) {
+        file.write(out.data(), out.size());
+        out.clear();
+      }
+    }
+  }
+  file.write(out.data(), out.size());
+}
+
+/**
+ * @brief Append the gate primitive driving `node` to `out`, e.g. `and(g,a,b);`
+ */
+void write_gate(const core::NodeMap& node_map, const core::Node* node, std::string& out) {
+  switch (node->type) {
+#define _(x, y, z, w)                                                                                                  \
+  case core::GateType::y:                                                                                              \
+    out += w;                                                                                                          \
+    break;
+    foreach_gate_type_no_in_out
+#undef _
+        default : break;
+  }
+
+  out += '(';
+  out += node->name;
+  out += ',';
+
+  const core::NodeList inputs = node_map.inputs_of(node);
+  for (std::size_t i = 0; i < inputs.size(); ++i) {
+    out += node_map.node(inputs[i])->name;
+    if (i < inputs.size() - 1) {
+      out += ',';
+    }
   }
 
-  // std::cout << node->name << ": " << output << std::endl;
-  dp[node] = output;
-  return output;
+  out += ");\n";
 }
 
 void write_to_verilog_file(const core::NodeMap& node_map, std::string output_file,
-                           bool show_intermediate_gate = false) {
+                           bool show_intermediate_gate = false, std::size_t threads = 0) {
+  core::PhaseTimer timer("verilog");
 
   // write to output.v
   std::ofstream file(output_file);
 
   if (!file.is_open()) {
-    std::cout << "Could not open output file" << output_file << std::endl;
-    exit(1);
+    throw std::runtime_error("Could not open output file " + output_file);
   }
 
   // write module header
@@ -142,70 +224,33 @@ void write_to_verilog_file(const core::NodeMap& node_map, std::string output_fil
 
     file << "wire ";
 
-    for (std::size_t i = 0; i < node_map.gates.size(); ++i) {
-      file << node_map.gates[i]->name;
-      if (i < node_map.gates.size() - 1) {
-        file << ',';
+    const std::size_t n_gates = node_map.gates.size();
+    core::write_chunked(file, n_gates, threads, [&](std::size_t begin, std::size_t end, std::string& out) {
+      for (std::size_t i = begin; i < end; ++i) {
+        out += node_map.gates[i]->name;
+        if (i < n_gates - 1) {
+          out += ',';
+        }
       }
-    }
+    });
 
     file << ";\n\n";
 
-    for (const auto& node : node_map.gates) {
-      switch (node->type) {
-#define _(x, y, z, w)                                                                                                  \
-  case core::GateType::y:                                                                                              \
-    file << w;                                                                                                         \
-    break;
-        foreach_gate_type_no_in_out
-#undef _
-            default : break;
+    core::write_chunked(file, n_gates, threads, [&](std::size_t begin, std::size_t end, std::string& out) {
+      for (std::size_t i = begin; i < end; ++i) {
+        write_gate(node_map, node_map.gates[i], out);
       }
-
-      file << "(" << node->name << ",";
-
-      for (std::size_t i = 0; i < node->inputs.size(); ++i) {
-        file << node->inputs[i]->name;
-        if (i < node->inputs.size() - 1) {
-          file << ",";
-        }
-      }
-
-      file << ");" << std::endl;
-    }
+    });
 
     // write output gates
+    std::string out;
     for (const auto& node : node_map.outputs) {
-      switch (node->type) {
-#define _(x, y, z, w)                                                                                                  \
-  case core::GateType::y:                                                                                              \
-    file << w;                                                                                                         \
-    break;
-        foreach_gate_type_no_in_out
-#undef _
-            default : break;
-      }
-
-      file << "(" << node->name << ",";
-
-      for (std::size_t i = 0; i < node->inputs.size(); ++i) {
-        file << node->inputs[i]->name;
-        if (i < node->inputs.size() - 1) {
-          file << ",";
-        }
-      }
-
-      file << ");" << std::endl;
+      write_gate(node_map, node, out);
     }
+    file.write(out.data(), out.size());
   }
   else {
-
-    std::unordered_map<const core::Node*, std::string> dp_map;
-
-    // write gate expression from output gates
-    for (core::Node* node : node_map.outputs) {
-      file << "assign " << node->name << " = " << get_node_expression(dp_map, node) << ";\n";
-    }
+    write_assignments(node_map, file);
   }
 
   file << "\nendmodule";
@@ -0,0 +1,44 @@
+#pragma once
+#include "thread_pool.hpp"
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace core {
+
+/**
+ * @brief Format `count` items on a thread pool and write them to `file` in order.
+ * Items are split into chunks, every chunk is formatted into its own buffer and the
+ * buffers of a round of chunks are written with one call each, so the stream is never
+ * flushed per line and at most one round of text is held in memory.
+ *
+ * @param file output stream
+ * @param count number of items
+ * @param threads number of threads including the caller, 0 uses every hardware thread
+ * @param format `format(begin, end, out)` appends items `[begin, end)` to `out`
+ */
+inline void write_chunked(std::ostream& file, std::size_t count, std::size_t threads,
+                          const std::function<void(std::size_t, std::size_t, std::string&)>& format) {
+  const std::size_t chunk_size = 1 << 14;
+  const std::size_t chunks = (count + chunk_size - 1) / chunk_size;
+  if (chunks <= 1) {
+    std::string out;
+    format(0, count, out);
+    file.write(out.data(), out.size());
+    return;
+  }
+  ThreadPool pool(threads);
+  std::vector<std::string> buffers(2 * pool.size());
+  for (std::size_t first = 0; first < chunks; first += buffers.size()) {
+    const std::size_t round = std::min(buffers.size(), chunks - first);
+    pool.run(round, [&](std::size_t task, std::size_t) {
+      const std::size_t begin = (first + task) * chunk_size;
+      buffers[task].clear();
+      format(begin, std::min(count, begin + chunk_size), buffers[task]);
+    });
+    for (std::size_t i = 0; i < round; ++i) file.write(buffers[i].data(), buffers[i].size());
+  }
+}
+
+}